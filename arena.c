@@ -0,0 +1,108 @@
+/*****************************************************************************
+ * arena.c: bump allocator for per-caption scratch memory
+ *****************************************************************************
+ * An arena is a chain of blocks filled front to back. A request bigger than
+ * what is left moves on to the next block, appending a new one sized to fit
+ * when the chain is exhausted. Reset only rewinds the fill marks.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "common.h"
+#include "arena.h"
+
+#define ARENA_ALIGN     16
+#define ARENA_HEADER    ( ( sizeof(arena_block_t) + ARENA_ALIGN - 1 ) & ~(size_t)( ARENA_ALIGN - 1 ) )
+
+void ArenaInit( arena_t *p_arena )
+{
+    p_arena->p_first = NULL;
+    p_arena->p_cur = NULL;
+}
+
+void ArenaClean( arena_t *p_arena )
+{
+    arena_block_t *p_block = p_arena->p_first;
+    while( p_block != NULL )
+    {
+        arena_block_t *p_next = p_block->p_next;
+        free( p_block );
+        p_block = p_next;
+    }
+    ArenaInit( p_arena );
+}
+
+void ArenaReset( arena_t *p_arena )
+{
+    for( arena_block_t *p_block = p_arena->p_first; p_block; p_block = p_block->p_next )
+        p_block->i_used = 0;
+    p_arena->p_cur = p_arena->p_first;
+}
+
+void *ArenaAlloc( arena_t *p_arena, size_t i_size )
+{
+    i_size = ( i_size + ARENA_ALIGN - 1 ) & ~(size_t)( ARENA_ALIGN - 1 );
+
+    arena_block_t *p_block = p_arena->p_cur;
+    arena_block_t *p_last = NULL;
+    while( p_block != NULL && p_block->i_size - p_block->i_used < i_size )
+    {
+        p_last = p_block;
+        p_block = p_block->p_next;
+    }
+
+    if( p_block == NULL )
+    {
+        size_t i_block = __MAX( i_size, ARENA_BLOCK_SIZE );
+        p_block = malloc( ARENA_HEADER + i_block );
+        if( p_block == NULL )
+            return NULL;
+        p_block->p_next = NULL;
+        p_block->i_size = i_block;
+        p_block->i_used = 0;
+        /* p_cur is only NULL while the arena has no block at all */
+        if( p_last != NULL )
+            p_last->p_next = p_block;
+        else
+            p_arena->p_first = p_block;
+    }
+    p_arena->p_cur = p_block;
+
+    void *p = (uint8_t *)p_block + ARENA_HEADER + p_block->i_used;
+    p_block->i_used += i_size;
+    return p;
+}
+
+void *ArenaCalloc( arena_t *p_arena, size_t i_count, size_t i_size )
+{
+    if( i_size != 0 && i_count > (size_t)-1 / i_size )
+        return NULL;
+    void *p = ArenaAlloc( p_arena, i_count * i_size );
+    if( p != NULL )
+        memset( p, 0, i_count * i_size );
+    return p;
+}
+
+char *ArenaPrintf( arena_t *p_arena, const char *psz_fmt, ... )
+{
+    va_list args;
+
+    va_start( args, psz_fmt );
+    int i_len = vsnprintf( NULL, 0, psz_fmt, args );
+    va_end( args );
+    if( i_len < 0 )
+        return NULL;
+
+    char *psz = ArenaAlloc( p_arena, i_len + 1 );
+    if( psz == NULL )
+        return NULL;
+    va_start( args, psz_fmt );
+    vsnprintf( psz, i_len + 1, psz_fmt, args );
+    va_end( args );
+    return psz;
+}
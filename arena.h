@@ -0,0 +1,36 @@
+/*****************************************************************************
+ * arena.h: bump allocator for per-caption scratch memory
+ *****************************************************************************
+ * Everything one caption PES needs is carved out of an arena and dropped at
+ * once with ArenaReset(). Blocks are kept across resets, so once the arena
+ * has grown to the largest caption seen it makes no more heap calls.
+ *****************************************************************************/
+
+#ifndef ARENA_H
+# define ARENA_H
+
+#include <stdarg.h>
+
+#define ARENA_BLOCK_SIZE    (64 * 1024)
+
+typedef struct arena_block_s
+{
+    struct arena_block_s *p_next;
+    size_t      i_size;
+    size_t      i_used;
+} arena_block_t;
+
+typedef struct arena_s
+{
+    arena_block_t   *p_first;
+    arena_block_t   *p_cur;
+} arena_t;
+
+void  ArenaInit( arena_t * );
+void  ArenaClean( arena_t * );
+void  ArenaReset( arena_t * );
+void *ArenaAlloc( arena_t *, size_t );
+void *ArenaCalloc( arena_t *, size_t, size_t );
+char *ArenaPrintf( arena_t *, const char *, ... );
+
+#endif
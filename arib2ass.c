@@ -32,6 +32,7 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
@@ -43,6 +44,10 @@
 
 #include <getopt.h>
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #if defined(HAVE_INTTYPES_H)
 #include <inttypes.h>
 #elif defined(HAVE_STDINT_H)
@@ -67,6 +72,7 @@
 #endif
 
 #include "common.h"
+#include "tsindex.h"
 
 #define SYSTEM_CLOCK_DR 0x0B
 #define MAX_BITRATE_DR 0x0E
@@ -74,6 +80,9 @@
 #define SUBTITLING_DR 0x59
 
 #define READBUFSZ 8192
+#define PCRSCANSZ (188 * 4500)
+#define CHUNKBUFSZ (188 * 5600)
+#define CHUNKMINSZ (16 * 1024 * 1024) /* smallest range worth a thread */
 
 #ifndef _WIN32
 #define O_BINARY 0
@@ -117,9 +126,10 @@ typedef struct ts_pid_s
     vlc_bool_t  b_pcr;  /* this PID is the PCR_PID */
     mtime_t     i_pcr;  /* last know PCR value */
 
-    dvbpsi_pmt_es_t* p_es;
+    vlc_bool_t  b_caption;  /* ARIB caption ES of the program */
     block_t     *p_block;
     mtime_t     i_pts;
+    int64_t     i_pes_pos;  /* offset of the PES unit start packet */
     int         i_pes_size;
     int         i_pes_gathered;
     decoder_t   *decoder;
@@ -155,8 +165,57 @@ typedef struct
     uint16_t    i_packet_size;
     int         i_fd;
 
+    /* to report progress */
+    int64_t     i_size;
+    mtime_t     i_duration;
+    int64_t     i_bytes_read;
+    int         i_status_fd;
+    int         i_progress_interval; /* seconds, 0 = disabled */
+    mtime_t     i_progress_start;
+    mtime_t     i_progress_last;
+
+    /* sidecar index, built while demuxing when requested */
+    ts_index_t  *p_index;
+    int         i_pes_done;
+
+    /* set on the per-thread copies of a parallel demux */
+    struct ts_chunk_s *p_chunk;
+
 } ts_stream_t;
 
+/* a caption PES gathered by a demux thread, decoded in file order */
+typedef struct ts_pes_s
+{
+    int64_t     i_pos;      /* offset of the PES unit start packet */
+    int64_t     i_done;     /* offset of the packet completing the PES */
+    uint16_t    i_pid;
+    mtime_t     i_pts;
+    block_t     block;
+} ts_pes_t;
+
+typedef struct ts_chunk_s
+{
+    ts_stream_t *p_stream;  /* private copy of the demux state */
+    ts_stream_t *p_main;
+    int64_t     i_start;
+    int64_t     i_end;      /* owns the PES starting before i_end */
+    int64_t     i_done;     /* bytes of [i_start, i_end) scanned */
+
+    int         i_turn;     /* position among the ranges */
+    struct ts_chunk_s *p_next;
+
+    int         i_pes;
+    int         i_pes_alloc;
+    ts_pes_t    *p_pes;
+    int         i_carry;    /* of the previous ranges, completed in this one */
+    ts_pes_t    *p_carry;
+
+    /* the reference PCRs in [i_start, i_end), for the index */
+    int             i_pcr;
+    int             i_pcr_alloc;
+    ts_index_pcr_t  *p_pcr;
+} ts_chunk_t;
+
 /*****************************************************************************
  * Local prototypes
  *****************************************************************************/
@@ -165,10 +224,11 @@ static void DumpPMT(void* p_data, dvbpsi_pmt_t* p_pmt);
 /*****************************************************************************
  * ReadPacket
  *****************************************************************************/
-static int ReadPacket( int i_fd, uint8_t* p_dst )
+static int ReadPacket( int i_fd, uint8_t* p_dst, int64_t *pi_pos )
 {
     static char *buf = NULL;
     static int  left = 0;
+    static int64_t i_read = 0; /* file offset of the end of buf */
     int i = 187;
     int i_rc = 1;
     int i_skip = 0;
@@ -188,12 +248,14 @@ static int ReadPacket( int i_fd, uint8_t* p_dst )
             i_rc = read(i_fd,buf+left,READBUFSZ-left);
             if (i_rc <= 0) return i_rc;
             left += i_rc;
+            i_read += i_rc;
         }
         i_skip = 0;
         for(i=READBUFSZ-left;i<READBUFSZ;i++) {
             if (buf[i] == 0x47) {
                 if ((left - i_skip) >= 188) {
                     memcpy(p_dst,buf+i,188);
+                    *pi_pos = i_read - (READBUFSZ - i);
                     left -= 188 + i_skip;
                     return 188;
                 }
@@ -452,7 +514,8 @@ static void DumpPMT(void* p_data, dvbpsi_pmt_t* p_pmt)
     {
         if (p_es->i_type == 0x06) { //
             if (PMTEsHasComponentTag(p_es,0x30,0x37)) {
-                p_stream->pid[p_es->i_pid].p_es = p_es;
+                p_stream->pid[p_es->i_pid].b_caption = VLC_TRUE;
+                p_stream->pid[p_es->i_pid].i_pid = p_es->i_pid;
                 if (p_stream->pid[p_es->i_pid].b_seen && !p_stream->pid[p_es->i_pid].decoder) {
                     p_stream->pid[p_es->i_pid].b_seen = VLC_FALSE;
                 }
@@ -507,14 +570,162 @@ static mtime_t GetPCR( uint8_t *p )
     return i_pcr;
 }
 
+/*****************************************************************************
+ * ScanPCR: look for PCRs in [i_start, i_end) without moving the read offset
+ *****************************************************************************
+ * Returns the first (b_last = false) or the last (b_last = true) PCR carried
+ * by i_pid, or by any PID when i_pid is -1 (the PID found is stored back).
+ *****************************************************************************/
+static mtime_t ScanPCR( ts_stream_t *p_stream, int64_t i_start, int64_t i_end,
+                        int *pi_pid, vlc_bool_t b_last )
+{
+    uint8_t *p_buf = malloc( READBUFSZ + p_stream->i_packet_size );
+    mtime_t i_found = -1;
+    int64_t i_pos = i_start;
+
+    if( !p_buf )
+        return -1;
+
+    while( i_pos < i_end )
+    {
+        ssize_t i_rc = pread( p_stream->i_fd, p_buf, READBUFSZ, i_pos );
+        int i = 0;
+        if( i_rc < p_stream->i_packet_size )
+            break;
+
+        /* resync on two consecutive sync bytes */
+        while( i + p_stream->i_packet_size < i_rc &&
+               ( p_buf[i] != 0x47 || p_buf[i + p_stream->i_packet_size] != 0x47 ) )
+            i++;
+        if( i + p_stream->i_packet_size >= i_rc )
+        {
+            i_pos += i_rc - p_stream->i_packet_size;
+            continue;
+        }
+
+        for( ; i + p_stream->i_packet_size <= i_rc; i += p_stream->i_packet_size )
+        {
+            uint8_t *p = &p_buf[i];
+            int i_pid = ((p[1] & 0x1f) << 8) | p[2];
+            mtime_t i_pcr;
+
+            if( p[0] != 0x47 )
+                break;
+            if( *pi_pid >= 0 && i_pid != *pi_pid )
+                continue;
+            if( ( i_pcr = GetPCR( p ) ) < 0 )
+                continue;
+
+            *pi_pid = i_pid;
+            i_found = i_pcr;
+            if( !b_last )
+                goto end;
+        }
+        i_pos += i;
+    }
+end:
+    free( p_buf );
+    return i_found;
+}
+
+/*****************************************************************************
+ * GetDuration: first and last PCR of the file give the total duration
+ *****************************************************************************/
+static void GetDuration( ts_stream_t *p_stream )
+{
+    int     i_pid = -1;
+    mtime_t i_first_pcr, i_last_pcr;
+    int64_t i_pos;
+
+    p_stream->i_duration = -1;
+
+    i_first_pcr = ScanPCR( p_stream, 0, __MIN( p_stream->i_size, 64 * PCRSCANSZ ),
+                           &i_pid, VLC_FALSE );
+    if( i_first_pcr < 0 )
+        return;
+
+    i_pos = p_stream->i_size - PCRSCANSZ;
+    if( i_pos < 0 )
+        i_pos = 0;
+    i_last_pcr = ScanPCR( p_stream, i_pos, p_stream->i_size, &i_pid, VLC_TRUE );
+    if( i_last_pcr < 0 )
+        return;
+    if( i_last_pcr < i_first_pcr )
+        i_last_pcr += 0x1FFFFFFFF;
+
+    mtime_t i_duration_msec = ( i_last_pcr - i_first_pcr ) * 100 / 9 / 1000;
+    int64_t i_rate = ( i_duration_msec <= 0 ) ? 0 : p_stream->i_size * 1000 * 8 / i_duration_msec;
+    /* ISDB recordings run from about 0.5 Mbit/s (one-seg) to 52 Mbit/s (a
+     * whole BS transponder); outside that the PCRs were reset in between */
+    const int64_t i_max_rate = 55 * 1000 * 1000;
+    const int64_t i_min_rate = 500 * 1000;
+    if( i_rate < i_min_rate || i_rate > i_max_rate )
+    {
+        fprintf( stderr, "calculated bitrate (%"PRId64"bit/s) is too low or too high, duration unknown\n",
+                 i_rate );
+        return;
+    }
+    p_stream->i_duration = i_last_pcr - i_first_pcr;
+}
+
+/*****************************************************************************
+ * mdate: current time in microseconds
+ *****************************************************************************/
+static mtime_t mdate( void )
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return (mtime_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*****************************************************************************
+ * ReportProgress: percent done, throughput and ETA to the status fd
+ *****************************************************************************/
+static void ReportProgress( ts_stream_t *p_stream, vlc_bool_t b_force )
+{
+    mtime_t i_now;
+    char    psz_line[256];
+    int     i_line;
+
+    if( p_stream->i_progress_interval <= 0 )
+        return;
+    i_now = mdate();
+    if( !b_force && i_now - p_stream->i_progress_last <
+            (mtime_t)p_stream->i_progress_interval * 1000000 )
+        return;
+    p_stream->i_progress_last = i_now;
+
+    mtime_t i_elapsed = i_now - p_stream->i_progress_start;
+    double  f_done = p_stream->i_size > 0 ?
+        (double)p_stream->i_bytes_read / p_stream->i_size : 0.;
+    double  f_rate = i_elapsed > 0 ?
+        (double)p_stream->i_bytes_read / i_elapsed : 0.; /* bytes/usec = MB/s */
+    int     i_eta = ( f_rate > 0. && f_done < 1. ) ?
+        (int)( ( p_stream->i_size - p_stream->i_bytes_read ) / f_rate / 1000000 ) : 0;
+    char    psz_pos[DUMPTS_SIZE] = "--", psz_dur[DUMPTS_SIZE] = "--";
+    if( p_stream->i_duration > 0 )
+    {
+        dumpts( psz_pos, (mtime_t)( f_done * p_stream->i_duration ) );
+        dumpts( psz_dur, p_stream->i_duration );
+    }
+
+    i_line = snprintf( psz_line, sizeof(psz_line),
+            "progress: %5.1f%% %7.2fMB/s ETA %02d:%02d:%02d pos %s/%s\n",
+            f_done * 100., f_rate, i_eta / 3600, i_eta / 60 % 60, i_eta % 60,
+            psz_pos, psz_dur );
+    if( i_line > 0 && write( p_stream->i_status_fd, psz_line,
+                __MIN( i_line, (int)sizeof(psz_line) - 1 ) ) < 0 )
+        p_stream->i_progress_interval = 0;
+}
+
 
 /*****************************************************************************
  * usage
  *****************************************************************************/
 static void usage( char *name )
 {
-    printf( "Usage: %s [--file <filename>|--help|--version|--debug|--output <ofilename>]\n", name );
-    printf( "       %s [-f <filename>|-h|-v|-d|-o <ofilename>]\n", name );
+    printf( "Usage: %s [--file <filename>|--help|--version|--debug|--output <ofilename>|--progress <sec>|--status-fd <fd>|--index|--threads <n>|--drcs-atlas|--drcs-drawing|--drcs-similar|--drcs-report <n>]\n", name );
+    printf( "       %s [-f <filename>|-h|-v|-d|-o <ofilename>|-p <sec>|-s <fd>|-i|-t <n>|-a|-g|-m|-r <n>]\n", name );
     printf( "\n" );
     printf( "       %s --help\n", name );
     printf( "       %s --file <filename> --output <ofilename>\n", name );
@@ -524,21 +735,671 @@ static void usage( char *name )
     printf( "output : output ASS filename \n" );
     printf( "help   : print this help message\n" );
     printf( "debug  : output debug info to <filename>.asslog \n" );
+    printf( "progress : report percent done, MB/s and ETA every <sec> seconds\n" );
+    printf( "status-fd: write progress reports to <fd> (default 2, stderr)\n" );
+    printf( "index  : write a caption index to <filename>.assidx, used by later runs\n" );
+    printf( "threads: demux large files on <n> threads (default 1)\n" );
+    printf( "drcs-atlas: put unknown DRCS glyphs in one <filename>.drcs.png\n" );
+    printf( "         listed in <filename>.drcs.ini instead of data/<md5>.png\n" );
+    printf( "drcs-drawing: draw unknown DRCS glyphs in the ASS file from their\n" );
+    printf( "         patterns instead of writing data/<md5>.png\n" );
+    printf( "drcs-similar: show unknown DRCS glyphs as the code of a mapped one\n" );
+    printf( "         that looks the same, listed in <filename>.drcs_similar.ini\n" );
+    printf( "drcs-report: list the <n> unmapped DRCS glyphs seen most often in\n" );
+    printf( "         all runs (0 for all) as drcs_conv.ini lines, after <filename>\n" );
+    printf( "         if one is given\n" );
 }
 static void printversion( char *name )
 {
     printf( "%s version %s\n", name ,VERSION);
 }
-static char *outputfilename = NULL;
+static dec_output_t output;  /* --output, shared by the decoders */
 static char *filename = NULL;
-static int  debugflg = 0;
+static int  decflags = 0;    /* DEC_* */
+static int  progress_interval = 0;
+static int  status_fd = 2;
+static int  indexflg = 0;
+static int  threads = 1;
+static int  drcs_report = -1;    /* glyphs listed by --drcs-report, 0 all */
+
+/*****************************************************************************
+ * PESComplete: a caption PES has been gathered in the packet at i_pos
+ *****************************************************************************/
+static void PESComplete( ts_stream_t *p_stream, ts_pid_t *p_pid, int64_t i_pos )
+{
+    ts_chunk_t *p_chunk = p_stream->p_chunk;
+
+    if( p_chunk )
+    {
+        ts_pes_t *p_pes;
+
+        /* the PES open at i_start belongs to the previous range */
+        if( p_pid->i_pes_pos >= p_chunk->i_end )
+            return;
+        if( p_chunk->i_pes >= p_chunk->i_pes_alloc )
+        {
+            int i_alloc = p_chunk->i_pes_alloc ? p_chunk->i_pes_alloc * 2 : 256;
+            p_pes = realloc( p_chunk->p_pes, i_alloc * sizeof(ts_pes_t) );
+            if( !p_pes )
+                return;
+            p_chunk->p_pes = p_pes;
+            p_chunk->i_pes_alloc = i_alloc;
+        }
+        p_pes = &p_chunk->p_pes[p_chunk->i_pes];
+        p_pes->block.p_buffer = malloc( p_pid->p_block->i_buffer );
+        if( !p_pes->block.p_buffer )
+            return;
+        memcpy( p_pes->block.p_buffer, p_pid->p_block->p_buffer, p_pid->p_block->i_buffer );
+        p_pes->block.i_buffer = p_pid->p_block->i_buffer;
+        p_pes->block.i_pts = p_pid->p_block->i_pts;
+        p_pes->i_pos = p_pid->i_pes_pos;
+        p_pes->i_done = i_pos;
+        p_pes->i_pid = p_pid->i_pid;
+        p_pes->i_pts = p_pid->i_pts;
+        p_chunk->i_pes++;
+        return;
+    }
+
+    if( p_stream->p_index )
+        IndexAddPES( p_stream->p_index, p_pid->i_pid, p_pid->i_pes_pos, p_pid->i_pts );
+
+    p_stream->i_pes_done++;
+    if (p_pid->decoder) {
+        p_pid->decoder->pf_decode_sub(p_pid->decoder,&p_pid->p_block);
+    }
+}
+
+/*****************************************************************************
+ * ChunkAddPCR: keep a PCR met by a demux thread for the index
+ *****************************************************************************/
+static void ChunkAddPCR( ts_chunk_t *p_chunk, mtime_t i_pcr, int64_t i_pos )
+{
+    /* the next range records those past the end */
+    if( !p_chunk->p_main->p_index || i_pos >= p_chunk->i_end )
+        return;
+    if( p_chunk->i_pcr >= p_chunk->i_pcr_alloc )
+    {
+        int i_alloc = p_chunk->i_pcr_alloc ? p_chunk->i_pcr_alloc * 2 : 256;
+        ts_index_pcr_t *p_pcr = realloc( p_chunk->p_pcr, i_alloc * sizeof(*p_pcr) );
+        if( !p_pcr )
+            return;
+        p_chunk->p_pcr = p_pcr;
+        p_chunk->i_pcr_alloc = i_alloc;
+    }
+    p_chunk->p_pcr[p_chunk->i_pcr].i_pcr = i_pcr;
+    p_chunk->p_pcr[p_chunk->i_pcr].i_pos = i_pos;
+    p_chunk->i_pcr++;
+}
+
+/*****************************************************************************
+ * OpenCaption: start decoding a caption PID
+ *****************************************************************************/
+static void OpenCaption( ts_stream_t *p_stream, int i_pid )
+{
+    ts_pid_t *p_pid = &p_stream->pid[i_pid];
+
+    if( !p_pid->p_block )
+        p_pid->p_block = calloc(1,sizeof(block_t));
+    /* the copies of the demux threads only gather, the PES go to the
+     * decoders of the main stream */
+    if( p_stream->p_chunk || p_pid->decoder )
+        return;
+    p_pid->decoder = calloc(1,sizeof(decoder_t));
+    dec_open(p_pid->decoder,filename,&output,decflags);
+    fprintf(stderr,"Target pid  0x%x PMT 0x%x \n",i_pid,p_stream->pmt.pid_pmt->i_pid);
+}
+
+/*****************************************************************************
+ * HandlePacket: demux one TS packet found at byte offset i_pos
+ *****************************************************************************/
+static void HandlePacket( ts_stream_t *p_stream, uint8_t *p_tmp, int64_t i_pos )
+{
+    uint8_t    i_skip = 0;
+    uint16_t   i_pid = ((uint16_t)(p_tmp[1] & 0x1f) << 8) + p_tmp[2];
+    int        i_cc = (p_tmp[3] & 0x0f);
+    vlc_bool_t b_adaptation = (p_tmp[3] & 0x20); /* adaptation field */
+    vlc_bool_t b_discontinuity = VLC_FALSE;
+    vlc_bool_t b_payload = (p_tmp[3] & 0x10);
+    vlc_bool_t b_unit_start = p_tmp[1]&0x40;
+
+    /* Get the PID */
+    ts_pid_t *p_pid = &p_stream->pid[i_pid];
+
+    /* demux threads use the PSI scanned before they were started */
+    if( !p_stream->p_chunk )
+    {
+        if( i_pid == 0x0 )
+            dvbpsi_packet_push(p_stream->pat.handle, p_tmp);
+        else if( p_stream->pmt.pid_pmt && i_pid == p_stream->pmt.pid_pmt->i_pid )
+            dvbpsi_packet_push(p_stream->pmt.handle, p_tmp);
+    }
+
+
+    /* Remember PID */
+    if(( !p_stream->pid[i_pid].b_seen ) && (p_stream->pmt.pid_pcr))
+    {
+        p_stream->pid[i_pid].b_seen = VLC_TRUE;
+        p_stream->pid[i_pid].i_cc = 0xff;
+        if (p_stream->pid[i_pid].b_caption)
+            OpenCaption( p_stream, i_pid );
+    }
+
+    /* Handle discontinuities if they occurred,
+     * according to ISO/IEC 13818-1: DIS pages 20-22 */
+    if( b_adaptation )
+    {
+        i_skip = 5 + p_tmp[4];
+
+        b_discontinuity = (p_tmp[5]&0x80) ? true : false;
+    }
+    else
+    {
+        i_skip = 4;
+    }
+
+    /* Test continuity counter */
+    /* continuous when (one of this):
+     * diff == 1
+     * diff == 0 and payload == 0
+     * diff == 0 and duplicate packet (playload != 0) <- should we
+     *   test the content ?
+     */
+    const int i_diff = ( i_cc - p_pid->i_cc )&0x0f;
+    if( b_payload && i_diff == 1 )
+    {
+        p_pid->i_cc = ( p_pid->i_cc + 1 ) & 0xf;
+    }
+    else 
+    {
+        if( p_pid->i_cc == 0xff )
+        {
+            p_pid->i_cc = i_cc;
+        }
+        else if( i_diff != 0 && !b_discontinuity )
+        {
+            p_pid->i_cc = i_cc;
+        }
+    }
+    mtime_t i_pcr = GetPCR( p_tmp );
+    if( i_pcr >= 0  && (p_stream->pmt.pid_pcr) && (i_pid == p_stream->pmt.pid_pcr->i_pid))
+    {
+        if (p_stream->i_pid_ref_pcr == -1) {
+            p_stream->i_pid_ref_pcr = i_pid;
+            p_stream->i_first_pcr = i_pcr;
+            p_stream->i_current_pcr = i_pcr;
+            char psz_pcr[DUMPTS_SIZE];
+            fprintf(stderr,"refpcr %s pid 0x%x\n",dumpts(psz_pcr,i_pcr),i_pid);
+        }
+        if( p_stream->i_pid_ref_pcr == p_pid->i_pid )
+        {
+            p_stream->i_current_pcr = AdjustPCRWrapAround( p_stream, i_pcr );
+            if( p_stream->p_index )
+                IndexAddPCR( p_stream->p_index, i_pcr, i_pos );
+            else if( p_stream->p_chunk )
+                ChunkAddPCR( p_stream->p_chunk, i_pcr, i_pos );
+        }
+    }
+    // payload 
+
+    uint8_t *header;
+    int     i_size;
+    header = p_tmp + i_skip;
+    i_size = p_stream->i_packet_size - i_skip;
+
+    // Invalid ?
+    if (i_size < 0) return;
+
+    if( b_unit_start )
+    {
+        if (p_pid->b_caption && p_pid->p_block) {
+            p_pid->i_pes_size = 0;
+            p_pid->i_pes_gathered = 0;
+            p_pid->i_pes_pos = i_pos;
+            if (p_pid->p_block->p_buffer) {
+                free(p_pid->p_block->p_buffer);
+                p_pid->p_block->i_buffer = 0;
+                p_pid->p_block->p_buffer = 0;
+            }
+        }
+        if (b_payload && p_pid->b_caption && p_pid->p_block) {
+            //printf("have payload %d offset %d\n",i_pid,p_tmp[i_skip]);
+            int skip2;
+            mtime_t i_pts,i_dts;
+            if( header[0] != 0 || header[1] != 0 || header[2] != 1 ) {
+                fprintf(stderr,"Invalid header\n");
+            }
+            else {
+                skip2=header[8]+9;
+                if(( ( header[6]&0xC0 ) == 0x80 ) && (i_size - skip2 > 0)){
+                    i_skip = i_skip + skip2;
+                    if( header[7]&0x80 )    /* has pts */
+                    {
+                        i_pts = ((mtime_t)(header[ 9]&0x0e ) << 29)|
+                            (mtime_t)(header[10] << 22)|
+                            ((mtime_t)(header[11]&0xfe) << 14)|
+                            (mtime_t)(header[12] << 7)|
+                            (mtime_t)(header[13] >> 1);
+
+                        if( header[7]&0x40 )    /* has dts */
+                        {
+                            i_dts = ((mtime_t)(header[14]&0x0e ) << 29)|
+                                (mtime_t)(header[15] << 22)|
+                                ((mtime_t)(header[16]&0xfe) << 14)|
+                                (mtime_t)(header[17] << 7)|
+                                (mtime_t)(header[18] >> 1);
+                        }
+                    }
+                    if (i_size > 6) {
+                        p_pid->i_pes_size = (header[4]<<8 | header[5]);
+                        if (p_pid->i_pes_size > 0) p_pid->i_pes_size += 6;
+                    }
+                    p_pid->p_block->p_buffer  = calloc(1,i_size);
+                    memcpy(p_pid->p_block->p_buffer,p_tmp+i_skip,i_size - skip2);
+                    p_pid->p_block->i_buffer = i_size - skip2;
+                    // first pcr - pts diff time
+                    if (i_pts < p_stream->i_first_pcr)
+                        i_pts += 0x1FFFFFFFF;
+                    p_pid->p_block->i_pts = i_pts - p_stream->i_first_pcr;
+                    p_pid->i_pts = i_pts;
+                    p_pid->i_pes_gathered += i_size;
+                    if( p_pid->i_pes_size > 0 &&
+                            p_pid->i_pes_gathered >= p_pid->i_pes_size )
+                    {
+                        /* XXX overflow??? */
+                        p_pid->p_block->p_buffer = realloc(p_pid->p_block->p_buffer,p_pid->p_block->i_buffer * 2);
+                        p_pid->p_block->p_buffer[p_pid->p_block->i_buffer+1]=0;
+                        p_pid->p_block->i_buffer += 1;
+                        PESComplete( p_stream, p_pid, i_pos );
+                    }
+                }
+            }
+        }
+    } // unit_start
+    else
+    {
+        if (b_payload && p_pid->b_caption && p_pid->p_block) {
+            p_pid->p_block->p_buffer = realloc(p_pid->p_block->p_buffer,p_pid->p_block->i_buffer+i_size);
+            memcpy(p_pid->p_block->p_buffer+p_pid->p_block->i_buffer,p_tmp+i_skip,i_size);
+            p_pid->p_block->i_buffer += i_size;
+            p_pid->i_pes_gathered += i_size; 
+            if( p_pid->i_pes_size > 0 &&
+                    p_pid->i_pes_gathered >= p_pid->i_pes_size )
+            {
+                /* XXX overflow??? */
+                p_pid->p_block->p_buffer = realloc(p_pid->p_block->p_buffer,p_pid->p_block->i_buffer * 2);
+                p_pid->p_block->p_buffer[p_pid->p_block->i_buffer+1]=0;
+                p_pid->p_block->i_buffer += 1;
+                PESComplete( p_stream, p_pid, i_pos );
+            }
+        }
+    }
+}
+
+/*****************************************************************************
+ * ReplayIndex: demux only the caption PES listed in the sidecar index
+ *****************************************************************************/
+static void ReplayIndex( ts_stream_t *p_stream, ts_index_t *p_index )
+{
+    const int i_max = 4 * 1024 * 1024; /* give up on a PES spread wider */
+    uint8_t *p_buf = malloc( READBUFSZ );
+
+    if( !p_buf )
+        return;
+
+    p_stream->pmt.pid_pmt = &p_stream->pid[p_index->i_pmt_pid];
+    p_stream->pmt.pid_pmt->i_pid = p_index->i_pmt_pid;
+    p_stream->pmt.pid_pcr = &p_stream->pid[p_index->i_pcr_pid];
+    p_stream->pmt.pid_pcr->i_pid = p_index->i_pcr_pid;
+    p_stream->pmt.pid_pcr->b_pcr = VLC_TRUE;
+    p_stream->i_pid_ref_pcr = p_index->i_pcr_pid;
+    p_stream->i_first_pcr = p_index->i_first_pcr;
+    p_stream->i_current_pcr = p_index->i_first_pcr;
+    for( int i = 0; i < p_index->i_pids; i++ )
+    {
+        p_stream->pid[p_index->pi_pids[i]].i_pid = p_index->pi_pids[i];
+        p_stream->pid[p_index->pi_pids[i]].b_caption = VLC_TRUE;
+    }
+
+    for( int i = 0; i < p_index->i_pes; i++ )
+    {
+        const ts_index_pes_t *p_pes = &p_index->p_pes[i];
+        const int i_done = p_stream->i_pes_done;
+        vlc_bool_t b_started = VLC_FALSE;
+        int64_t i_pos = p_pes->i_pos;
+
+        while( p_stream->i_pes_done == i_done && i_pos - p_pes->i_pos < i_max )
+        {
+            ssize_t i_rc = pread( p_stream->i_fd, p_buf, READBUFSZ, i_pos );
+            if( i_rc < p_stream->i_packet_size )
+                break;
+            for( int j = 0; j + p_stream->i_packet_size <= i_rc &&
+                    p_stream->i_pes_done == i_done; j += p_stream->i_packet_size )
+            {
+                uint8_t *p = &p_buf[j];
+                if( p[0] != 0x47 )
+                    goto next;
+                if( ( ((p[1] & 0x1f) << 8) | p[2] ) != p_pes->i_pid )
+                    continue;
+                if( p[1] & 0x40 )
+                {
+                    if( b_started ) /* the next PES, this one never completed */
+                        goto next;
+                    b_started = VLC_TRUE;
+                }
+                HandlePacket( p_stream, p, i_pos + j );
+            }
+            i_pos += i_rc - i_rc % p_stream->i_packet_size;
+        }
+next:
+        p_stream->i_bytes_read = p_pes->i_pos;
+        ReportProgress( p_stream, VLC_FALSE );
+    }
+    free( p_buf );
+}
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t decode_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  decode_cond = PTHREAD_COND_INITIALIZER;
+static int             decode_turn; /* the range decoding its PES */
+
+/*****************************************************************************
+ * CloneStream: private demux state for one thread
+ *****************************************************************************
+ * The first range continues the PES left open by the PSI scan, the others
+ * start clean and pick up the first caption PES starting in their range.
+ *****************************************************************************/
+static ts_stream_t *CloneStream( ts_stream_t *p_main, ts_chunk_t *p_chunk,
+                                 vlc_bool_t b_keep_pes )
+{
+    ts_stream_t *p_stream = malloc( sizeof(ts_stream_t) );
+
+    if( !p_stream )
+        return NULL;
+    memcpy( p_stream, p_main, sizeof(ts_stream_t) );
+    p_stream->pat.handle = NULL;
+    p_stream->pmt.handle = NULL;
+    if( p_main->pmt.pid_pmt )
+        p_stream->pmt.pid_pmt = &p_stream->pid[p_main->pmt.pid_pmt - p_main->pid];
+    if( p_main->pmt.pid_pcr )
+        p_stream->pmt.pid_pcr = &p_stream->pid[p_main->pmt.pid_pcr - p_main->pid];
+    p_stream->p_index = NULL;
+    p_stream->i_progress_interval = 0;
+    p_stream->p_chunk = p_chunk;
+
+    for( int i = 0; i < 8192; i++ )
+    {
+        ts_pid_t *p_pid = &p_stream->pid[i];
+        block_t *p_block = p_pid->p_block;
+
+        p_pid->decoder = NULL;
+        if( !p_block )
+            continue;
+        p_pid->p_block = calloc( 1, sizeof(block_t) );
+        if( !p_pid->p_block )
+            continue;
+        if( b_keep_pes && p_block->p_buffer )
+        {
+            p_pid->p_block->p_buffer = malloc( p_block->i_buffer );
+            if( p_pid->p_block->p_buffer )
+            {
+                memcpy( p_pid->p_block->p_buffer, p_block->p_buffer, p_block->i_buffer );
+                p_pid->p_block->i_buffer = p_block->i_buffer;
+                p_pid->p_block->i_pts = p_block->i_pts;
+            }
+        }
+        if( !p_pid->p_block->p_buffer )
+        {
+            p_pid->i_pes_size = 0;
+            p_pid->i_pes_gathered = 0;
+        }
+    }
+    return p_stream;
+}
+
+static void DeleteStream( ts_stream_t *p_stream )
+{
+    for( int i = 0; i < 8192; i++ )
+    {
+        if( p_stream->pid[i].p_block )
+        {
+            free( p_stream->pid[i].p_block->p_buffer );
+            free( p_stream->pid[i].p_block );
+        }
+    }
+    free( p_stream );
+}
+
+/* a PES started before the end of the range is still being gathered */
+static vlc_bool_t ChunkPending( ts_chunk_t *p_chunk )
+{
+    ts_stream_t *p_stream = p_chunk->p_stream;
+
+    for( int i = 0; i < 8192; i++ )
+    {
+        ts_pid_t *p_pid = &p_stream->pid[i];
+        if( p_pid->b_caption && p_pid->p_block && p_pid->p_block->p_buffer &&
+            p_pid->i_pes_pos < p_chunk->i_end &&
+            p_pid->i_pes_size > 0 && p_pid->i_pes_gathered < p_pid->i_pes_size )
+            return VLC_TRUE;
+    }
+    return VLC_FALSE;
+}
+
+/*****************************************************************************
+ * DecodeChunk: decode the PES of a range after those of the previous ranges
+ *****************************************************************************
+ * The PES go in the order a single threaded run completes them. Those of a
+ * range completed past its end are handed to the next range, to be merged
+ * with the ones it completes first.
+ *****************************************************************************/
+static void DecodeChunk( ts_chunk_t *p_chunk )
+{
+    ts_stream_t *p_stream = p_chunk->p_main;
+    ts_pes_t *p_pes = p_chunk->p_pes, *p_carry;
+    ts_pes_t *p_left = NULL;
+    int i_pes = p_chunk->i_pes, i_carry;
+    int i_left = 0;
+    vlc_bool_t b_hand = p_chunk->p_next != NULL;
+
+    pthread_mutex_lock( &decode_lock );
+    while( decode_turn != p_chunk->i_turn )
+        pthread_cond_wait( &decode_cond, &decode_lock );
+    p_carry = p_chunk->p_carry;
+    i_carry = p_chunk->i_carry;
+    pthread_mutex_unlock( &decode_lock );
+
+    /* decoders for the caption PIDs first met in this range */
+    for( int i = 0; i < 8192; i++ )
+    {
+        ts_pid_t *p_pid = &p_chunk->p_stream->pid[i];
+        if( p_pid->b_caption && p_pid->p_block && !p_stream->pid[i].decoder )
+        {
+            p_stream->pid[i].b_seen = VLC_TRUE;
+            OpenCaption( p_stream, i );
+        }
+    }
+
+    if( p_stream->p_index )
+        for( int i = 0; i < p_chunk->i_pcr; i++ )
+            IndexAddPCR( p_stream->p_index, p_chunk->p_pcr[i].i_pcr,
+                         p_chunk->p_pcr[i].i_pos );
+
+    for( int i = 0, j = 0; i < i_pes || j < i_carry; )
+    {
+        ts_pes_t *p;
+
+        if( j >= i_carry || ( i < i_pes && p_pes[i].i_done < p_carry[j].i_done ) )
+            p = &p_pes[i++];
+        else
+            p = &p_carry[j++];
+
+        /* the rest is completed in the next range */
+        if( b_hand && !p_left && p->i_done >= p_chunk->i_end )
+        {
+            p_left = malloc( ( i_pes - i + i_carry - j + 1 ) * sizeof(ts_pes_t) );
+            b_hand = p_left != NULL;
+        }
+        if( p_left )
+        {
+            p_left[i_left++] = *p;
+            continue;
+        }
+
+        ts_pid_t *p_pid = &p_stream->pid[p->i_pid];
+        block_t *p_block = &p->block;
+
+        if( p_stream->p_index )
+            IndexAddPES( p_stream->p_index, p->i_pid, p->i_pos, p->i_pts );
+        p_stream->i_pes_done++;
+        if( p_pid->decoder )
+            p_pid->decoder->pf_decode_sub( p_pid->decoder, &p_block );
+        free( p->block.p_buffer );
+    }
+    p_chunk->i_pes = 0; /* the buffers are freed or handed on */
+    p_chunk->i_carry = 0;
+    free( p_carry );
+    p_chunk->p_carry = NULL;
+
+    pthread_mutex_lock( &decode_lock );
+    if( p_chunk->p_next )
+    {
+        p_chunk->p_next->p_carry = p_left;
+        p_chunk->p_next->i_carry = i_left;
+    }
+    decode_turn++;
+    pthread_cond_broadcast( &decode_cond );
+    pthread_mutex_unlock( &decode_lock );
+}
+
+/*****************************************************************************
+ * DemuxChunk: thread gathering, then decoding, the caption PES of a range
+ *****************************************************************************/
+static void *DemuxChunk( void *p_data )
+{
+    ts_chunk_t *p_chunk = p_data;
+    ts_stream_t *p_stream = p_chunk->p_stream;
+    uint8_t *p_buf = malloc( CHUNKBUFSZ );
+    int64_t i_pos = p_chunk->i_start;
+
+    if( !p_buf )
+        goto done;
+
+    for( ;; )
+    {
+        ssize_t i_rc = pread( p_stream->i_fd, p_buf, CHUNKBUFSZ, i_pos );
+        int i = 0;
+
+        if( i_rc < p_stream->i_packet_size )
+            break;
+        while( i + p_stream->i_packet_size <= i_rc )
+        {
+            if( p_buf[i] != 0x47 )
+            {
+                i++;
+                continue;
+            }
+            if( i_pos + i >= p_chunk->i_end && !ChunkPending( p_chunk ) )
+            {
+                i_pos += i;
+                goto done;
+            }
+            HandlePacket( p_stream, &p_buf[i], i_pos + i );
+            i += p_stream->i_packet_size;
+        }
+        i_pos += i;
+
+        if( p_chunk->i_done < p_chunk->i_end - p_chunk->i_start )
+        {
+            int64_t i_done = __MIN( i_pos, p_chunk->i_end ) - p_chunk->i_start;
+
+            pthread_mutex_lock( &progress_lock );
+            p_chunk->p_main->i_bytes_read += i_done - p_chunk->i_done;
+            ReportProgress( p_chunk->p_main, VLC_FALSE );
+            pthread_mutex_unlock( &progress_lock );
+            p_chunk->i_done = i_done;
+        }
+    }
+done:
+    free( p_buf );
+    DecodeChunk( p_chunk );
+    return NULL;
+}
+
+/*****************************************************************************
+ * DemuxParallel: demux and decode [i_start, size) on i_threads threads
+ *****************************************************************************
+ * Each thread demuxes its range, then decodes it once the previous ranges
+ * are decoded, so the output is identical to a single threaded run's while
+ * the later ranges are still being demuxed.
+ *****************************************************************************/
+static int DemuxParallel( ts_stream_t *p_stream, int64_t i_start, int i_threads )
+{
+    int64_t i_range = ( p_stream->i_size - i_start ) / i_threads;
+    ts_chunk_t *p_chunks;
+    pthread_t *p_threads;
+    int i_started;
+    int i_ret = -1;
+
+    i_range -= i_range % p_stream->i_packet_size;
+    p_chunks = calloc( i_threads, sizeof(ts_chunk_t) );
+    p_threads = calloc( i_threads, sizeof(pthread_t) );
+    if( !p_chunks || !p_threads )
+        goto end;
+
+    for( int i = 0; i < i_threads; i++ )
+    {
+        p_chunks[i].p_main = p_stream;
+        p_chunks[i].i_start = i_start + i * i_range;
+        p_chunks[i].i_end = i == i_threads - 1 ? p_stream->i_size :
+                                                 i_start + ( i + 1 ) * i_range;
+        p_chunks[i].i_turn = i;
+        p_chunks[i].p_next = i == i_threads - 1 ? NULL : &p_chunks[i + 1];
+        p_chunks[i].p_stream = CloneStream( p_stream, &p_chunks[i], i == 0 );
+        if( !p_chunks[i].p_stream )
+            goto end;
+    }
+    fprintf( stderr, "demux on %d threads\n", i_threads );
+
+    decode_turn = 0;
+    for( i_started = 0; i_started < i_threads; i_started++ )
+    {
+        if( pthread_create( &p_threads[i_started], NULL, DemuxChunk,
+                            &p_chunks[i_started] ) )
+            break;
+    }
+    /* the ranges left without a thread are done on this one */
+    for( int i = i_started; i < i_threads; i++ )
+        DemuxChunk( &p_chunks[i] );
+    for( int i = 0; i < i_started; i++ )
+        pthread_join( p_threads[i], NULL );
+    i_ret = 0;
+
+end:
+    if( p_chunks )
+    {
+        for( int i = 0; i < i_threads; i++ )
+        {
+            for( int j = 0; j < p_chunks[i].i_pes; j++ )
+                free( p_chunks[i].p_pes[j].block.p_buffer );
+            free( p_chunks[i].p_pes );
+            free( p_chunks[i].p_pcr );
+            if( p_chunks[i].p_stream )
+                DeleteStream( p_chunks[i].p_stream );
+        }
+    }
+    free( p_chunks );
+    free( p_threads );
+    return i_ret;
+}
+#endif
 
 /*****************************************************************************
  * main
  *****************************************************************************/
 int main(int i_argc, char* pa_argv[])
 {
-    const char* const short_options = "hdf:vo:";
+    const char* const short_options = "hdf:vo:p:s:it:agmr:";
     const struct option long_options[] =
     {
         { "help",       0, NULL, 'h' },
@@ -546,6 +1407,14 @@ int main(int i_argc, char* pa_argv[])
         { "file",       1, NULL, 'f' },
         { "output",     1, NULL, 'o' },
         { "version",    0, NULL, 'v' },
+        { "progress",   1, NULL, 'p' },
+        { "status-fd",  1, NULL, 's' },
+        { "index",      0, NULL, 'i' },
+        { "threads",    1, NULL, 't' },
+        { "drcs-atlas", 0, NULL, 'a' },
+        { "drcs-drawing", 0, NULL, 'g' },
+        { "drcs-similar", 0, NULL, 'm' },
+        { "drcs-report", 1, NULL, 'r' },
         { NULL,         0, NULL, 0 }
     };
     int next_option = 0;
@@ -558,10 +1427,14 @@ int main(int i_argc, char* pa_argv[])
 #endif
     mtime_t  i_prev_pcr = 0;  /* 33 bits */
     int      i_old_cc = -1;
-    uint32_t i_bytes = 0; /* bytes transmitted between PCR's */
 
     uint8_t *p_data = NULL;
     ts_stream_t *p_stream = NULL;
+    ts_index_t *p_index = NULL;
+    char *indexfilename = NULL;
+    struct stat st;
+    int64_t i_pos = 0;
+    vlc_bool_t b_parallel;
     int i_len = 0;
     int b_verbose = 0;
     int i = 0;
@@ -575,7 +1448,7 @@ int main(int i_argc, char* pa_argv[])
                 filename = strdup( optarg );
                 break;
             case 'o':
-                outputfilename = strdup( optarg );
+                output.psz_file = strdup( optarg );
                 break;
             case 'h':
                 usage( pa_argv[0] );
@@ -586,7 +1459,31 @@ int main(int i_argc, char* pa_argv[])
                 goto error;
                 break;
             case 'd':
-                debugflg = 1;
+                decflags |= DEC_DEBUG;
+                break;
+            case 'p':
+                progress_interval = atoi( optarg );
+                break;
+            case 's':
+                status_fd = atoi( optarg );
+                break;
+            case 'i':
+                indexflg = 1;
+                break;
+            case 't':
+                threads = atoi( optarg );
+                break;
+            case 'a':
+                decflags |= DEC_DRCS_ATLAS;
+                break;
+            case 'g':
+                decflags |= DEC_DRCS_DRAWING;
+                break;
+            case 'm':
+                decflags |= DEC_DRCS_SIMILAR;
+                break;
+            case 'r':
+                drcs_report = atoi( optarg );
                 break;
             case -1:
                 break;
@@ -604,6 +1501,11 @@ int main(int i_argc, char* pa_argv[])
         if( !p_data )
             goto out_of_memory;
     }
+    else if( drcs_report >= 0 )
+    {
+        dec_drcs_report( stdout, drcs_report );
+        return EXIT_SUCCESS;
+    }
     else
     {
         usage( pa_argv[0] );
@@ -624,10 +1526,52 @@ int main(int i_argc, char* pa_argv[])
     p_stream->p_pos = (int64_t *)calloc( p_stream->i_pcrs_num, sizeof( int64_t ) );
     p_stream->i_packet_size = 188;
     p_stream->i_fd = i_fd;
+    p_stream->i_status_fd = status_fd;
+    p_stream->i_progress_interval = progress_interval;
+
+    memset( &st, 0, sizeof(st) );
+    if( fstat( i_fd, &st ) == 0 )
+        p_stream->i_size = st.st_size;
+
+    /* Use the caption index of a previous run when it matches the file */
+    if( asprintf( &indexfilename, "%s.assidx", filename ) < 0 )
+        indexfilename = NULL;
+    if( indexfilename )
+        p_index = IndexRead( indexfilename, st.st_size, st.st_mtime );
+    if( p_index )
+    {
+        fprintf( stderr, "using index %s (%d PES)\n", indexfilename, p_index->i_pes );
+        if( p_index->i_pcr >= 2 )
+        {
+            const ts_index_pcr_t *p_first = &p_index->p_pcr[0];
+            const ts_index_pcr_t *p_last = &p_index->p_pcr[p_index->i_pcr - 1];
+            if( p_last->i_pos > p_first->i_pos && p_last->i_pcr > p_first->i_pcr )
+                p_stream->i_duration = ( p_last->i_pcr - p_first->i_pcr ) *
+                    ( p_stream->i_size - p_first->i_pos ) /
+                    ( p_last->i_pos - p_first->i_pos );
+        }
+    }
+    else if( indexflg && indexfilename )
+    {
+        p_stream->p_index = IndexNew();
+        if( !p_stream->p_index )
+            goto out_of_memory;
+        p_stream->p_index->i_size = st.st_size;
+        p_stream->p_index->i_mtime = st.st_mtime;
+    }
+
+    if( progress_interval > 0 )
+    {
+        if( p_stream->i_duration <= 0 )
+            GetDuration( p_stream );
+        p_stream->i_progress_start = p_stream->i_progress_last = mdate();
+    }
+
+    b_parallel = threads > 1 && !p_index;
 
     /* Read first packet */
-    if( filename )
-        i_len = ReadPacket( i_fd, p_data );
+    if( filename && !p_index )
+        i_len = ReadPacket( i_fd, p_data, &i_pos );
 
     p_stream->pat.handle = dvbpsi_new(&message, DVBPSI_MSG_ERROR);
     if (p_stream->pat.handle == NULL)
@@ -636,220 +1580,52 @@ int main(int i_argc, char* pa_argv[])
         i_len = -1;
 
 
+    if( p_index )
+    {
+        ReplayIndex( p_stream, p_index );
+        IndexDelete( p_index );
+    }
+
     /* Enter infinite loop */
     while( i_len > 0 )
     {
-        vlc_bool_t b_first = VLC_FALSE;
-
-        i_bytes += i_len;
-        for( i = 0; i < i_len; i += 188 )
-        {
-            uint8_t    i_skip = 0;
-            uint8_t   *p_tmp = &p_data[i];
-            uint16_t   i_pid = ((uint16_t)(p_tmp[1] & 0x1f) << 8) + p_tmp[2];
-            int        i_cc = (p_tmp[3] & 0x0f);
-            vlc_bool_t b_adaptation = (p_tmp[3] & 0x20); /* adaptation field */
-            vlc_bool_t b_discontinuity = VLC_FALSE;
-            vlc_bool_t b_payload = (p_tmp[3] & 0x10);
-            vlc_bool_t b_unit_start = p_tmp[1]&0x40;
-
-            /* Get the PID */
-            ts_pid_t *p_pid = &p_stream->pid[ ((p_tmp[i+1]&0x1f)<<8)|p_tmp[i+2] ];
-
-            if( i_pid == 0x0 )
-                dvbpsi_packet_push(p_stream->pat.handle, p_tmp);
-            else if( p_stream->pmt.pid_pmt && i_pid == p_stream->pmt.pid_pmt->i_pid )
-                dvbpsi_packet_push(p_stream->pmt.handle, p_tmp);
-
-
-            /* Remember PID */
-            if(( !p_stream->pid[i_pid].b_seen ) && (p_stream->pmt.pid_pcr))
-            {
-                p_stream->pid[i_pid].b_seen = VLC_TRUE;
-                p_stream->pid[i_pid].i_cc = 0xff;
-                if (p_stream->pid[i_pid].p_es) {
-                    p_stream->pid[i_pid].p_block = calloc(1,sizeof(block_t));
-                    p_stream->pid[i_pid].decoder = calloc(1,sizeof(decoder_t));
-                    dec_open(p_stream->pid[i_pid].decoder,filename,outputfilename,debugflg);
-                    fprintf(stderr,"Target pid  0x%x PMT 0x%x \n",i_pid,p_stream->pmt.pid_pmt->i_pid);
-                }
-            }
-
-            /* Handle discontinuities if they occurred,
-             * according to ISO/IEC 13818-1: DIS pages 20-22 */
-            if( b_adaptation )
-            {
-                vlc_bool_t b_discontinuity_indicator = (p_tmp[5]&0x80);
-                vlc_bool_t b_random_access_indicator = (p_tmp[5]&0x40);
-                vlc_bool_t b_pcr = (p_tmp[5]&0x10);  /* PCR flag */
-
-                i_skip = 5 + p_tmp[4];
+        HandlePacket( p_stream, p_data, i_pos );
 
-                b_discontinuity = (p_tmp[5]&0x80) ? true : false;
+        p_stream->i_bytes_read += i_len;
+        ReportProgress( p_stream, VLC_FALSE );
 
-            }
-            else
-            {
-                i_skip = 4;
-            }
-
-            /* Test continuity counter */
-            /* continuous when (one of this):
-             * diff == 1
-             * diff == 0 and payload == 0
-             * diff == 0 and duplicate packet (playload != 0) <- should we
-             *   test the content ?
-             */
-            const int i_diff = ( i_cc - p_pid->i_cc )&0x0f;
-            if( b_payload && i_diff == 1 )
-            {
-                p_pid->i_cc = ( p_pid->i_cc + 1 ) & 0xf;
-            }
-            else 
-            {
-                if( p_pid->i_cc == 0xff )
-                {
-                    p_pid->i_cc = i_cc;
-                }
-                else if( i_diff != 0 && !b_discontinuity )
-                {
-                    p_pid->i_cc = i_cc;
-                    if( p_pid->p_es /* && p_pid->es->fmt.i_cat != VIDEO_ES */ )
-                    {
-                        /* Small video artifacts are usually better than
-                         * dropping full frames 
-                         p_pid->p_es->i_flags |= BLOCK_FLAG_CORRUPTED;
-                         */
-                    }
-                }
-            }
-            mtime_t i_pcr = GetPCR( p_tmp );
-            if( i_pcr >= 0  && (p_stream->pmt.pid_pcr) && (i_pid == p_stream->pmt.pid_pcr->i_pid))
-            {
-                if (p_stream->i_pid_ref_pcr == -1) {
-                    p_stream->i_pid_ref_pcr = i_pid;
-                    p_stream->i_first_pcr = i_pcr;
-                    p_stream->i_current_pcr = i_pcr;
-                    fprintf(stderr,"refpcr %s pid 0x%x\n",dumpts(i_pcr),i_pid);
-                }
-                if( p_stream->i_pid_ref_pcr == p_pid->i_pid )
-                {
-                    p_stream->i_current_pcr = AdjustPCRWrapAround( p_stream, i_pcr );
-                }
-
-
-            }
-            // payload 
-
-            uint8_t *header;
-            int     i_size;
-            header = p_tmp + i_skip;
-            i_size = i_len - i_skip;
-
-            // Invalid ?
-            if (i_size < 0) break;
-
-            if( b_unit_start )
-            {
-                if (p_pid->p_es && p_pid->p_block) {
-                    p_pid->i_pes_size = 0;
-                    p_pid->i_pes_gathered = 0;
-                    if (p_pid->p_block->p_buffer) {
-                        free(p_pid->p_block->p_buffer);
-                        p_pid->p_block->i_buffer = 0;
-                        p_pid->p_block->p_buffer = 0;
-                    }
-                }
-                if (b_payload && p_pid->p_es && p_pid->p_block) {
-                    //printf("have payload %d offset %d\n",i_pid,p_tmp[i_skip]);
-                    int skip2;
-                    mtime_t i_pts,i_dts;
-                    if( header[0] != 0 || header[1] != 0 || header[2] != 1 ) {
-                        fprintf(stderr,"Invalid header\n");
-                    }
-                    else {
-                        skip2=header[8]+9;
-                        if(( ( header[6]&0xC0 ) == 0x80 ) && (i_size - skip2 > 0)){
-                            i_skip = i_skip + skip2;
-                            if( header[7]&0x80 )    /* has pts */
-                            {
-                                i_pts = ((mtime_t)(header[ 9]&0x0e ) << 29)|
-                                    (mtime_t)(header[10] << 22)|
-                                    ((mtime_t)(header[11]&0xfe) << 14)|
-                                    (mtime_t)(header[12] << 7)|
-                                    (mtime_t)(header[13] >> 1);
-
-                                if( header[7]&0x40 )    /* has dts */
-                                {
-                                    i_dts = ((mtime_t)(header[14]&0x0e ) << 29)|
-                                        (mtime_t)(header[15] << 22)|
-                                        ((mtime_t)(header[16]&0xfe) << 14)|
-                                        (mtime_t)(header[17] << 7)|
-                                        (mtime_t)(header[18] >> 1);
-                                }
-                            }
-                            if (i_size > 6) {
-                                p_pid->i_pes_size = (header[4]<<8 | header[5]);
-                                if (p_pid->i_pes_size > 0) p_pid->i_pes_size += 6;
-                            }
-                            p_pid->p_block->p_buffer  = calloc(1,i_size);
-                            memcpy(p_pid->p_block->p_buffer,p_tmp+i_skip,i_size - skip2);
-                            p_pid->p_block->i_buffer = i_size - skip2;
-                            // first pcr - pts diff time
-                            if (i_pts < p_stream->i_first_pcr)
-                                i_pts += 0x1FFFFFFFF;
-                            p_pid->p_block->i_pts = i_pts - p_stream->i_first_pcr;
-                            p_pid->i_pts = i_pts;
-                            p_pid->i_pes_gathered += i_size;
-                            if( p_pid->i_pes_size > 0 &&
-                                    p_pid->i_pes_gathered >= p_pid->i_pes_size )
-                            {
-                                /* XXX overflow??? */
-                                p_pid->p_block->p_buffer = realloc(p_pid->p_block->p_buffer,p_pid->p_block->i_buffer * 2);
-                                p_pid->p_block->p_buffer[p_pid->p_block->i_buffer+1]=0;
-                                p_pid->p_block->i_buffer += 1;
-                                if (p_pid->decoder) {
-                                    p_pid->decoder->pf_decode_sub(p_pid->decoder,&p_pid->p_block);
-                                }
-                            }
-                        }
-                        else {
-
-                        }
-                    }
-                }
-            } // unit_start
-            else
-            {
-                if (b_payload && p_pid->p_es && p_pid->p_block) {
-                    if( p_pid->p_es == NULL )
-                    {
-
-                    }
-                    else
-                    {
-                        p_pid->p_block->p_buffer = realloc(p_pid->p_block->p_buffer,p_pid->p_block->i_buffer+i_size);
-                        memcpy(p_pid->p_block->p_buffer+p_pid->p_block->i_buffer,p_tmp+i_skip,i_size);
-                        p_pid->p_block->i_buffer += i_size;
-                        p_pid->i_pes_gathered += i_size; 
-                        if( p_pid->i_pes_size > 0 &&
-                                p_pid->i_pes_gathered >= p_pid->i_pes_size )
-                        {
-                            /* XXX overflow??? */
-                            p_pid->p_block->p_buffer = realloc(p_pid->p_block->p_buffer,p_pid->p_block->i_buffer * 2);
-                            p_pid->p_block->p_buffer[p_pid->p_block->i_buffer+1]=0;
-                            p_pid->p_block->i_buffer += 1;
-                            if (p_pid->decoder) {
-                                p_pid->decoder->pf_decode_sub(p_pid->decoder,&p_pid->p_block);
-                            }
-                        }
-                    }
-                }
-            }
+#ifdef HAVE_PTHREAD_H
+        /* hand the rest of the file to the threads once the PSI is known */
+        if( b_parallel && p_stream->i_first_pcr >= 0 )
+        {
+            int64_t i_rest = p_stream->i_size - ( i_pos + i_len );
+            int i_threads = __MIN( threads, i_rest / CHUNKMINSZ );
 
+            b_parallel = VLC_FALSE;
+            if( i_threads > 1 &&
+                DemuxParallel( p_stream, i_pos + i_len, i_threads ) == 0 )
+                break;
         }
+#endif
 
-        i_len = ReadPacket( i_fd, p_data );
+        i_len = ReadPacket( i_fd, p_data, &i_pos );
+    }
+    if( p_stream->i_size > 0 )
+        p_stream->i_bytes_read = p_stream->i_size;
+    ReportProgress( p_stream, VLC_TRUE );
+
+    if( p_stream->p_index )
+    {
+        ts_index_t *p_new = p_stream->p_index;
+
+        if( p_stream->pmt.pid_pmt )
+            p_new->i_pmt_pid = p_stream->pmt.pid_pmt->i_pid;
+        p_new->i_pcr_pid = p_stream->i_pid_ref_pcr;
+        p_new->i_first_pcr = p_stream->i_first_pcr;
+        if( p_new->i_pcr_pid >= 0 && IndexWrite( p_new, indexfilename ) == 0 )
+            fprintf( stderr, "wrote index %s (%d PES)\n", indexfilename, p_new->i_pes );
+        IndexDelete( p_new );
+        p_stream->p_index = NULL;
     }
 
     if( p_stream->pmt.handle )
@@ -869,8 +1645,9 @@ int main(int i_argc, char* pa_argv[])
         close( i_fd );
 
     if( p_data )    free( p_data );
-    if( filename )  free( filename );
+    free( indexfilename );
 
+    /* the decoders still refer to filename until they are closed */
     for(i=0;i<8192;i++) {
         ts_pid_t *p_pid = &p_stream->pid[i];
         if (p_pid && p_pid->decoder) {
@@ -880,6 +1657,12 @@ int main(int i_argc, char* pa_argv[])
         if (p_pid && p_pid->p_block)
             free(p_pid->p_block);
     }
+    if( output.fp && output.fp != stdout )
+        fclose( output.fp );
+    if( filename )  free( filename );
+    /* after the decoders, whose glyphs are in the catalog by now */
+    if( drcs_report >= 0 )
+        dec_drcs_report( stdout, drcs_report );
     /* free other stuff first ;-)*/
     if( p_stream )  {
         free( p_stream->p_pcrs );
@@ -25,12 +25,17 @@
 # include "config.h"
 #endif
 
+#include "arena.h"
+#include "drcsmap.h"
+
 #define DEBUG_ARIBB24DEC 1
 
 #define ADD_HLC_SUPPORT 1
 #define ADD_FLC_SUPPORT 1
 
-#define DRCS_HASH_TABLE_SIZE 10
+#define DRCS_SETS   16  /* DRCS-0 (2-byte) and DRCS-1 to DRCS-15 (1-byte) */
+#define DRCS_CODES  94  /* per 1-byte set, and per row of DRCS-0 */
+#define DRCS_PAGES  ( DRCS_CODES + DRCS_SETS - 1 )
 
 #if 0
 /*****************************************************************************
@@ -96,24 +101,123 @@ typedef struct  drcs_font_data_s
 typedef struct drc_code_s
 {
     int16_t            i_CharacterCode;
-    int8_t             i_NumberOfFont;
+    uint8_t            i_NumberOfFont;
     drcs_font_data_t   *p_drcs_font_data;
 } drcs_code_t;
 
 typedef struct drcs_data_s
 {
-    int8_t      i_NumberOfCode;
+    uint8_t     i_NumberOfCode;
 
     drcs_code_t *p_drcs_code;
 } drcs_data_t;
 #endif //ARIBSUB_GEN_DRCS_DATA
 
-typedef struct drcs_conversion_s {
-    char                     hash[32+1];
-    unsigned int             code;
+/*
+ * DRCS glyphs received so far, owned by the caller of the decoder. A glyph
+ * stays defined until the broadcaster redefines its code. Codes are 0-93
+ * within a 1-byte set and row * 94 + column within DRCS-0; each 1-byte set
+ * and each row of DRCS-0 gets a page of its own when first defined.
+ *
+ * Whole glyph sets are often sent for a few of them to be shown, so a
+ * definition only copies the pattern; it is hashed by pf_resolve_drcs of
+ * the decoder when a caption first uses the code.
+ */
+typedef struct drcs_glyph_s
+{
+    uint8_t b_defined;
+    uint8_t b_pending;          /* not hashed yet, digest is not set */
+    uint8_t digest[DRCS_DIGEST_SIZE];
+    uint8_t i_width;
+    uint8_t i_height;
+    uint8_t i_depth;
+    const char *psz_drawing;    /* ASS drawing of the pattern, or NULL */
+    unsigned int i_code;        /* code point of a look-alike, or 0 */
+    int8_t  *p_pattern;         /* kept for the next definition of the code */
+    size_t  i_pattern;
+    size_t  i_pattern_max;
+} drcs_glyph_t;
+
+typedef struct drcs_table_s
+{
+    drcs_glyph_t *p_page[DRCS_PAGES];
+} drcs_table_t;
+
+static inline int drcs_table_page( int i_set, int i_code )
+{
+    if( i_code < 0 )
+        return -1;
+    if( i_set == 0 )
+        return i_code < DRCS_CODES * DRCS_CODES ? i_code / DRCS_CODES : -1;
+    if( i_set < DRCS_SETS && i_code < DRCS_CODES )
+        return DRCS_CODES + i_set - 1;
+    return -1;
+}
+
+static inline drcs_glyph_t *drcs_table_get( drcs_table_t *p_drcs,
+                                            int i_set, int i_code )
+{
+    int i_page = drcs_table_page( i_set, i_code );
+    if( p_drcs == NULL || i_page < 0 ||
+        p_drcs->p_page[i_page] == NULL )
+        return NULL;
+    drcs_glyph_t *p_glyph = &p_drcs->p_page[i_page][i_code % DRCS_CODES];
+    return p_glyph->b_defined ? p_glyph : NULL;
+}
+
+/* NULL for codes outside the sets; the glyph comes back pending */
+static inline drcs_glyph_t *drcs_table_define( drcs_table_t *p_drcs, int i_set,
+        int i_code, int i_width, int i_height, int i_depth,
+        const int8_t *p_pattern, size_t i_pattern )
+{
+    int i_page = drcs_table_page( i_set, i_code );
+    if( i_page < 0 )
+        return NULL;
+    if( p_drcs->p_page[i_page] == NULL )
+    {
+        p_drcs->p_page[i_page] = calloc( DRCS_CODES, sizeof(drcs_glyph_t) );
+        if( p_drcs->p_page[i_page] == NULL )
+            return NULL;
+    }
+    drcs_glyph_t *p_glyph = &p_drcs->p_page[i_page][i_code % DRCS_CODES];
+    if( i_pattern > p_glyph->i_pattern_max )
+    {
+        int8_t *p_new = realloc( p_glyph->p_pattern, i_pattern );
+        if( p_new == NULL )
+            return NULL;
+        p_glyph->p_pattern = p_new;
+        p_glyph->i_pattern_max = i_pattern;
+    }
+    memcpy( p_glyph->p_pattern, p_pattern, i_pattern );
+    p_glyph->i_pattern = i_pattern;
+    p_glyph->i_width = i_width;
+    p_glyph->i_height = i_height;
+    p_glyph->i_depth = i_depth;
+    p_glyph->b_defined = 1;
+    p_glyph->b_pending = 1;
+    p_glyph->psz_drawing = NULL;
+    p_glyph->i_code = 0;
+    return p_glyph;
+}
+
+static inline void drcs_table_init( drcs_table_t *p_drcs )
+{
+    for( int i = 0; i < DRCS_PAGES; i++ )
+        p_drcs->p_page[i] = NULL;
+}
 
-    struct drcs_conversion_s *p_next;
-} drcs_conversion_t ;
+static inline void drcs_table_clean( drcs_table_t *p_drcs )
+{
+    for( int i = 0; i < DRCS_PAGES; i++ )
+    {
+        if( p_drcs->p_page[i] == NULL )
+            continue;
+        for( int j = 0; j < DRCS_CODES; j++ )
+            free( p_drcs->p_page[i][j].p_pattern );
+        free( p_drcs->p_page[i] );
+    }
+    drcs_table_init( p_drcs );
+}
 
 typedef struct arib_buf_region_s
 {
@@ -169,6 +273,8 @@ typedef struct arib_decoder_s
     int (*handle_g2)(struct arib_decoder_s *, int);
     int (*handle_g3)(struct arib_decoder_s *, int);
     int kanji_ku;
+    int drcs_row;           /* first byte of a DRCS-0 code, -1 if none */
+    uint8_t i_drcs_set[4];  /* DRCS set designated to G0-G3 */
 
     int i_control_time;
 
@@ -206,11 +312,11 @@ typedef struct arib_decoder_s
     int i_charleft;
     int i_charbottom;
 
-    int i_drcs_num;
-    char drcs_hash_table[DRCS_HASH_TABLE_SIZE][32 + 1];
-    char drcs_hash_code[DRCS_HASH_TABLE_SIZE];
-
-    drcs_conversion_t *p_drcs_conv;
+    drcs_table_t *p_drcs;
+    const drcs_map_t *p_drcs_conv;
+    /* hashes a pending glyph of p_drcs, called on its first use */
+    void (*pf_resolve_drcs)( void *, drcs_glyph_t * );
+    void *p_resolve_drcs_sys;
 
 #ifdef ADD_HLC_SUPPORT
     char i_hlcstate;
@@ -222,8 +328,20 @@ typedef struct arib_decoder_s
 
     arib_buf_region_t *p_region;
     bool b_need_next_region;
+
+    arena_t *p_arena;   /* regions are carved from it when set */
 } arib_decoder_t;
 
+static arib_buf_region_t *decoder_new_region( arib_decoder_t *decoder )
+{
+    if( decoder->p_arena != NULL )
+    {
+        return (arib_buf_region_t*) ArenaCalloc( decoder->p_arena,
+                1, sizeof(arib_buf_region_t) );
+    }
+    return (arib_buf_region_t*) calloc( 1, sizeof(arib_buf_region_t) );
+}
+
 static void decoder_adjust_position( arib_decoder_t *decoder )
 {
 #if 0
@@ -317,7 +435,7 @@ static int decoder_pushhlc( arib_decoder_t *decoder)
     {
         //start HLC REGION
 	if (decoder->p_hlcregion == NULL) {
-            decoder->p_hlcregion = (arib_buf_region_t*) calloc( 1, sizeof(arib_buf_region_t) );
+            decoder->p_hlcregion = decoder_new_region( decoder );
             if( decoder->p_hlcregion == NULL )
             {
                 return 0;
@@ -325,7 +443,7 @@ static int decoder_pushhlc( arib_decoder_t *decoder)
             p_hlcregion = decoder->p_hlcregion;
 	}
 	else {
-            p_hlcregion->p_next = (arib_buf_region_t*) calloc( 1, sizeof(arib_buf_region_t) );
+            p_hlcregion->p_next = decoder_new_region( decoder );
             p_hlcregion = p_hlcregion->p_next;
 	}
         p_hlcregion->i_charleft = decoder->i_charleft;
@@ -501,7 +619,7 @@ static int decoder_push( arib_decoder_t *decoder, unsigned int uc )
     if( p_region == NULL )
     {
         p_region = decoder->p_region = 
-            (arib_buf_region_t*) calloc( 1, sizeof(arib_buf_region_t) );
+            decoder_new_region( decoder );
         if( p_region == NULL )
         {
             return 0;
@@ -545,7 +663,7 @@ static int decoder_push( arib_decoder_t *decoder, unsigned int uc )
     if( decoder->b_need_next_region )
     {
         p_region = p_region->p_next =
-            (arib_buf_region_t*) calloc( 1, sizeof(arib_buf_region_t) );
+            decoder_new_region( decoder );
         if( p_region == NULL )
         {
             return 0;
@@ -612,36 +730,88 @@ static int decoder_pull( arib_decoder_t *decoder, int *c )
     return 1;
 }
 
-static int decoder_handle_drcs( arib_decoder_t *decoder, int c )
+/*
+ * An unknown DRCS glyph drawn from its pattern. Like the HLC boxes it gets
+ * a region of its own, whose text is the drawing scaled to the font size;
+ * a geta stands for it in the decoded string.
+ */
+static int decoder_push_drawing( arib_decoder_t *decoder,
+                                 const drcs_glyph_t *p_glyph )
+{
+    if( decoder->p_arena == NULL )
+    {
+        return decoder_push( decoder, 0x3013 ); /* geta */
+    }
+    char *psz_text = ArenaPrintf( decoder->p_arena,
+            "{\\fscx%d\\fscy%d\\p1}%s{\\p0}",
+            100 * decoder->i_fontwidth_cur / p_glyph->i_width,
+            100 * decoder->i_fontheight_cur / p_glyph->i_height,
+            p_glyph->psz_drawing );
+    if( psz_text == NULL )
+    {
+        return 0;
+    }
+
+    decoder->b_need_next_region = true;
+    if( decoder_push( decoder, 0x3013 ) == 0 )
+    {
+        return 0;
+    }
+    arib_buf_region_t *p_region = decoder->p_region;
+    while( p_region->p_next != NULL )
+    {
+        p_region = p_region->p_next;
+    }
+    p_region->p_start = psz_text;
+    p_region->p_end = psz_text + strlen( psz_text );
+    decoder->b_need_next_region = true;
+    return 1;
+}
+
+static int decoder_handle_drcs( arib_decoder_t *decoder, int i_set, int c )
 {
-    unsigned int uc,i;
+    drcs_glyph_t *p_glyph;
+    unsigned int uc;
 
-    // Check DRCS code
-    for(i=0;i<DRCS_HASH_TABLE_SIZE;i++) {
-        if (c == decoder->drcs_hash_code[i]) {
-           c=i;
-           break;
+    if( i_set == 0 ) /* DRCS-0 codes are two bytes */
+    {
+        if( decoder->drcs_row < 0 )
+        {
+            decoder->drcs_row = c;
+            return 1;
         }
+        c += DRCS_CODES * decoder->drcs_row;
+        decoder->drcs_row = -1;
     }
 
     uc = 0;
-    if( c < decoder->i_drcs_num )
+    p_glyph = drcs_table_get( decoder->p_drcs, i_set, c );
+    if( p_glyph != NULL && p_glyph->b_pending &&
+        decoder->pf_resolve_drcs != NULL )
     {
-        drcs_conversion_t *p_drcs_conv =  decoder->p_drcs_conv;
-        while( p_drcs_conv != NULL )
-        {
-            if( strcmp( p_drcs_conv->hash, decoder->drcs_hash_table[c] ) == 0 )
-            {
+        decoder->pf_resolve_drcs( decoder->p_resolve_drcs_sys, p_glyph );
+    }
+    if( p_glyph != NULL && p_glyph->b_pending )
+    {
+        p_glyph = NULL;     /* no digest to look up */
+    }
+    if( p_glyph != NULL )
+    {
+        uc = DrcsConvGet( decoder->p_drcs_conv, p_glyph->digest );
+        if( uc == 0 )
+            uc = p_glyph->i_code;
 #ifdef DEBUG_ARIBB24DEC
-                fprintf( stderr, "drcs hash[%s] converted to U+%x\n",
-                         p_drcs_conv->hash,
-                         p_drcs_conv->code);
-#endif //DEBUG_ARIBB24DEC
-                uc = p_drcs_conv->code;
-                break;
-            }
-            p_drcs_conv = p_drcs_conv->p_next;
+        if( uc != 0 )
+        {
+            char psz_hash[2 * DRCS_DIGEST_SIZE + 1];
+            fprintf( stderr, "drcs hash[%s] converted to U+%x\n",
+                     DrcsDigestToHex( psz_hash, p_glyph->digest ), uc );
         }
+#endif //DEBUG_ARIBB24DEC
+    }
+    if( uc == 0 && p_glyph != NULL && p_glyph->psz_drawing != NULL )
+    {
+        return decoder_push_drawing( decoder, p_glyph );
     }
     if( uc == 0 )
     {
@@ -649,13 +819,43 @@ static int decoder_handle_drcs( arib_decoder_t *decoder, int c )
         /* uc = 0x25A1; */ /* WHITE SQUARE */
         uc = 0x3013; /* geta */
 #ifdef DEBUG_ARIBB24DEC
-        fprintf( stderr, "drcs hash[%s] c[%d] not converted\n", decoder->drcs_hash_table[c],c);
+        char psz_hash[2 * DRCS_DIGEST_SIZE + 1] = "";
+        if( p_glyph != NULL )
+            DrcsDigestToHex( psz_hash, p_glyph->digest );
+        fprintf( stderr, "drcs hash[%s] c[%d] not converted\n", psz_hash, c );
 #endif
     }
 
     return decoder_push( decoder, uc );
 }
 
+/* one handler per G slot, each reading the set designated to it */
+static int decoder_handle_drcs_g0( arib_decoder_t *decoder, int c )
+{
+    return decoder_handle_drcs( decoder, decoder->i_drcs_set[0], c );
+}
+
+static int decoder_handle_drcs_g1( arib_decoder_t *decoder, int c )
+{
+    return decoder_handle_drcs( decoder, decoder->i_drcs_set[1], c );
+}
+
+static int decoder_handle_drcs_g2( arib_decoder_t *decoder, int c )
+{
+    return decoder_handle_drcs( decoder, decoder->i_drcs_set[2], c );
+}
+
+static int decoder_handle_drcs_g3( arib_decoder_t *decoder, int c )
+{
+    return decoder_handle_drcs( decoder, decoder->i_drcs_set[3], c );
+}
+
+static int (* const decoder_handle_drcs_g[4])( arib_decoder_t *, int ) =
+{
+    decoder_handle_drcs_g0, decoder_handle_drcs_g1,
+    decoder_handle_drcs_g2, decoder_handle_drcs_g3,
+};
+
 static const unsigned int decoder_alnum_table[] = {
     0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027, 0x0028,
     0x0029, 0x002a, 0x002b, 0x002c, 0x002d, 0x002e, 0x002f, 0x0030,
@@ -1945,14 +2145,17 @@ static int decoder_handle_esc( arib_decoder_t *decoder )
     int c;
     int (**handle)(arib_decoder_t *, int);
     int state_drcs;
+    int i_slot;
 
     handle = &decoder->handle_g0;
+    i_slot = 0;
     state_drcs = 0;
     while( decoder_pull( decoder, &c ) != 0 )
     {
         if (state_drcs == 1 && (c == 0x42 || c == 0x4a)) {
             // DRCS(1b 2x 20)に続く 0x42,0x4aはhandle_drcsを強制
-            *handle = decoder_handle_drcs;
+            decoder->i_drcs_set[i_slot] = c - 0x40;
+            *handle = decoder_handle_drcs_g[i_slot];
             return 1;
         }
         switch( c )
@@ -1965,12 +2168,15 @@ static int decoder_handle_esc( arib_decoder_t *decoder )
                 break;
             case 0x29:
                 handle = &decoder->handle_g1;
+                i_slot = 1;
                 break;
             case 0x2a:
                 handle = &decoder->handle_g2;
+                i_slot = 2;
                 break;
             case 0x2b:
                 handle = &decoder->handle_g3;
+                i_slot = 3;
                 break;
             case 0x30:
             case 0x37:
@@ -2005,7 +2211,8 @@ static int decoder_handle_esc( arib_decoder_t *decoder )
             case 0x4d:
             case 0x4e:
             case 0x4f:
-                *handle = decoder_handle_drcs;
+                decoder->i_drcs_set[i_slot] = c - 0x40;
+                *handle = decoder_handle_drcs_g[i_slot];
                 return 1;
             case 0x6e: //LS2
                 decoder->handle_gl = &decoder->handle_g2;
@@ -2872,6 +3079,9 @@ static void arib_initialize_decoder( arib_decoder_t* decoder, bool b_caption )
         decoder->handle_g3 = decoder_handle_katakana;
     }
     decoder->kanji_ku = -1;
+    decoder->drcs_row = -1;
+    for( int i = 0; i < 4; i++ )
+        decoder->i_drcs_set[i] = 0;
 
     decoder->i_control_time = 0;
 
@@ -2905,15 +3115,10 @@ static void arib_initialize_decoder( arib_decoder_t* decoder, bool b_caption )
     decoder->i_charleft = decoder->i_left;
     decoder->i_charbottom = decoder->i_top + decoder->i_charheight - 1;
 
-    decoder->i_drcs_num = 0;
-#if 0
-    for( int i = 0; i < 10; i++ )
-    {
-        memset(decoder->drcs_hash_table[i], 0, 32+1);
-    }
-#endif
-
+    decoder->p_drcs = NULL;
     decoder->p_drcs_conv = NULL;
+    decoder->pf_resolve_drcs = NULL;
+    decoder->p_resolve_drcs_sys = NULL;
 
 #ifdef ADD_HLC_SUPPORT
     decoder->i_hlcstate = 0;
@@ -2925,11 +3130,32 @@ static void arib_initialize_decoder( arib_decoder_t* decoder, bool b_caption )
 
     decoder->p_region = NULL;
     decoder->b_need_next_region = true;
+
+    decoder->p_arena = NULL;
+}
+
+/*
+ * Start over from a decoder set up once with arib_initialize_decoder(),
+ * which is cheaper than redoing the designations and geometry for every
+ * caption. The DRCS table, conversion list and arena are shared with it.
+ */
+static void arib_reset_decoder( arib_decoder_t* decoder,
+                                const arib_decoder_t* p_pristine )
+{
+    *decoder = *p_pristine;
+    /* GL and GR point into the G0-G3 slots of the decoder itself */
+    decoder->handle_gl = &decoder->handle_g0;
+    decoder->handle_gl_single = NULL;
+    decoder->handle_gr = &decoder->handle_g2;
 }
 
 static void arib_finalize_decoder( arib_decoder_t* decoder )
 {
     arib_buf_region_t *p_region, *p_region_next;
+    if( decoder->p_arena != NULL )
+    {
+        return; /* released with the arena */
+    }
     for( p_region = decoder->p_region; p_region; p_region = p_region_next )
     {
         p_region_next = p_region->p_next;
@@ -29,14 +29,27 @@
 #include <math.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
 
 #ifdef HAVE_STDBOOL_H
 #include <stdbool.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include "common.h"
 
 #include "vlc_bits.h"
 #include "vlc_md5.h"
+#include "crc16.h"
+#include "arena.h"
+#include "drcsmap.h"
+#include "drcsmemo.h"
+#include "drcscat.h"
+#include "drcssim.h"
+#include "drcspng.h"
 
 #include "png.h"
 
@@ -46,66 +59,158 @@
 
 #define DEBUG_ARIBSUB 1
 
+/* data units plus DRCS glyphs one PES may make us parse */
+#define ARIB_PES_WORK_BUDGET 1024
+
 /****************************************************************************
  * Local structures
  ****************************************************************************/
 
 
+/* last data group of one kind, to spot retransmissions */
+typedef struct data_group_cache_s
+{
+    uint8_t           *p_data;  /* header to CRC_16, so it covers the version */
+    size_t            i_data;
+    size_t            i_alloc;
+    uint64_t          i_hash;
+    mtime_t           i_pts;
+} data_group_cache_t;
+
+/* an unknown DRCS pattern waiting to be written as PNG */
+typedef struct drcs_png_job_s
+{
+    struct drcs_png_job_s *p_next;
+    char    psz_hash[32 + 1];
+    int     i_width;
+    int     i_height;
+    int     i_depth;
+    int8_t  p_patternData[];
+} drcs_png_job_t;
+
+/* DEC_DRCS_ATLAS: the unknown glyphs of every caption PID of the input */
+typedef struct drcs_atlas_s
+{
+    drcs_png_job_t    *p_first;
+    drcs_png_job_t    **pp_last;
+    int               i_count;
+    drcs_map_t        tiles;        /* digests already in the list */
+    int               i_decoders;   /* open decoders sharing it */
+} drcs_atlas_t;
+
+/*
+ * PNG files are written by a thread of their own so that a slow data dir
+ * does not hold up decoding. Without it they are written in line. The jobs
+ * written are kept on p_written, only touched by the thread that writes,
+ * and marked in the catalog once the writer is stopped.
+ */
+typedef struct drcs_writer_s
+{
+    bool              b_running;
+    bool              b_quit;
+    drcs_png_job_t    *p_first;
+    drcs_png_job_t    **pp_last;
+    drcs_png_job_t    *p_written;
+#ifdef HAVE_PTHREAD_H
+    pthread_t         thread;
+    pthread_mutex_t   lock;
+    pthread_cond_t    wait;
+#endif
+} drcs_writer_t;
+
+typedef struct ass_region_buf_s
+{
+    char    *p_buf;     /* Dialogue line past its start and end times */
+    unsigned char    f_blink;
+    mtime_t i_start;
+    struct ass_region_buf_s *p_next;
+}ass_region_buf_t;
+
 struct decoder_sys_t
 {
-    bs_t              bs;
+    bs64_t            bs;
+    mtime_t           i_pts;    /* of the PES being parsed */
 
     /* Decoder internal data */
 #if 0
     arib_data_group_t data_group;
 #endif
     uint32_t          i_data_unit_size;
+    int               i_crc_errors;     /* data groups rejected by CRC_16 */
+    int               i_parse_errors;   /* data groups given up while parsing */
+    int               i_work_budget;    /* left for the current PES */
+    data_group_cache_t management_cache;
+    data_group_cache_t statement_cache;
     int               i_subtitle_data_size;
+    uint32_t          i_subtitle_data_max;  /* allocated for the data units */
     unsigned char     *psz_subtitle_data;
 
     char              *psz_fontfamily;
     bool              b_ignore_ruby;
 
     arib_decoder_t    arib_decoder;
+    arib_decoder_t    arib_decoder_pristine;    /* arib_decoder is reset to it */
 #ifdef ARIBSUB_GEN_DRCS_DATA
     drcs_data_t       *p_drcs_data;
 #endif //ARIBSUB_GEN_DRCS_DATA
 
-    int               i_drcs_num;
-    char              drcs_hash_table[DRCS_HASH_TABLE_SIZE][32 + 1];
-    char              drcs_hash_code[DRCS_HASH_TABLE_SIZE];
+    drcs_table_t      drcs;
+
+    drcs_map_t        drcs_conv;    /* drcs_conv.ini */
+    drcs_map_t        drcs_saved;   /* 1: PNG in the data dir, 2: queued */
+    drcs_memo_t       drcs_memo;    /* digests of the patterns seen so far */
+    drcs_catalog_t    drcs_catalog; /* every pattern of every run */
+    drcs_similar_t    drcs_similar; /* DEC_DRCS_SIMILAR: the mapped glyphs */
+    drcs_map_t        drcs_guessed; /* unknown patterns given a look-alike's code */
+    FILE              *similarfp;   /* <input>.drcs_similar.ini */
+    drcs_writer_t     drcs_writer;
+    drcs_atlas_t      *p_atlas;     /* DEC_DRCS_ATLAS: p_output->p_atlas */
+    drcs_map_t        drcs_drawing; /* DEC_DRCS_DRAWING: index + 1 in pp_drawing */
+    const char        **pp_drawing;
+    unsigned int      i_drawing;
+    arena_t           drawing_arena;    /* the drawings, kept for the run */
+
+    int               i_flags;      /* DEC_* given to dec_open */
+
+    char              *psz_data_dir;
+    bool              b_data_dir_ready;  /* created, for the PNG writer */
+
+    arena_t           arena;        /* scratch of the PES being decoded */
+    arena_t           ass_arena;    /* lines of p_ass, waiting for their end */
+    ass_region_buf_t  *p_ass;
 
-    drcs_conversion_t *p_drcs_conv;
-    char              *outputfile;
+    dec_output_t      *p_output;
     char              *inputfile;
-    FILE              *outputfp;
+    FILE              *outputfp;    /* p_output->fp once a line is written */
     FILE              *debugfp;
 };
 
-typedef struct ass_region_buf_s
-{
-    char    *p_buf;
-    unsigned char    f_blink;
-    mtime_t i_start;
-    struct ass_region_buf_s *p_next;
-}ass_region_buf_t;
-
 /*****************************************************************************
  * Local prototypes
  *****************************************************************************/
 static void load_drcs_conversion_table( decoder_t * );
-static void parse_data_unit( decoder_t * );
-static void parse_caption_management_data( decoder_t * );
-static void parse_caption_statement_data( decoder_t * );
-static void parse_data_group( decoder_t * );
-static void parse_arib_pes( decoder_t * );
+static void load_saved_drcs_images( decoder_t * );
+static void load_catalog_drcs_images( decoder_t * );
+static void load_similar_drcs_images( decoder_t *, bool );
+static void save_drcs_catalog( decoder_t * );
+static void resolve_drcs_glyph( void *, drcs_glyph_t * );
+static char* get_arib_data_dir( decoder_t * );
+static bool parse_data_unit( decoder_t * );
+static bool parse_caption_management_data( decoder_t * );
+static bool parse_caption_statement_data( decoder_t * );
+static bool parse_data_group( decoder_t * );
+static bool parse_arib_pes( decoder_t * );
 static bool isallspace(char *,int);
 static void dumpheader(decoder_t *);
 static void dumpregion(decoder_t *,ass_region_buf_t *,mtime_t);
 static void pushregion(decoder_t *,mtime_t,mtime_t);
 static void dumparib(decoder_t *,mtime_t);
 static void free_all(decoder_t *);
-static void free_assregion(ass_region_buf_t *);
+static void flushregion(decoder_t *,mtime_t);
+static void drcs_writer_start( decoder_t * );
+static void drcs_writer_stop( decoder_t * );
+static void save_drcs_atlas( decoder_t * );
+static void free_drcs_png_jobs( drcs_png_job_t * );
 
 static void *Decode( void *dec, block_t **pp_block )
 {
@@ -119,14 +224,24 @@ static void *Decode( void *dec, block_t **pp_block )
         return NULL;
     }
     p_block = *pp_block;
-    bs_init( &p_sys->bs, p_block->p_buffer, p_block->i_buffer );
+    bs64_init( &p_sys->bs, p_block->p_buffer, p_block->i_buffer );
+    p_sys->i_pts = p_block->i_pts;
+    p_sys->i_work_budget = ARIB_PES_WORK_BUDGET;
 
-    parse_arib_pes( p_dec );
+    if( parse_arib_pes( p_dec ) )
+        dumparib(p_dec,p_block->i_pts);
 
-    dumparib(p_dec,p_block->i_pts);
+    /* drop everything parsed out of this PES at once */
+    ArenaReset( &p_sys->arena );
+    p_sys->psz_subtitle_data = NULL;
+    p_sys->i_subtitle_data_size = 0;
+    p_sys->i_subtitle_data_max = 0;
+#ifdef ARIBSUB_GEN_DRCS_DATA
+    p_sys->p_drcs_data = NULL;
+#endif //ARIBSUB_GEN_DRCS_DATA
 }
 
-void *dec_open(void *p_this,char *input,char *output,int debugflg)
+void *dec_open(void *p_this,char *input,dec_output_t *output,int flags)
 {
     decoder_t     *p_dec = (decoder_t *) p_this;
     decoder_sys_t *p_sys;
@@ -135,21 +250,70 @@ void *dec_open(void *p_this,char *input,char *output,int debugflg)
     p_sys = p_dec->p_sys = (decoder_sys_t*) calloc( 1, sizeof(decoder_sys_t) );
     if (p_sys == NULL) return NULL;
 
+    p_sys->i_flags = flags;
+    if( flags & DEC_DRCS_ATLAS )
+    {
+        if( output->p_atlas == NULL && ( output->p_atlas = malloc( sizeof(drcs_atlas_t) ) ) )
+        {
+            output->p_atlas->p_first = NULL;
+            output->p_atlas->pp_last = &output->p_atlas->p_first;
+            output->p_atlas->i_count = 0;
+            DrcsMapInit( &output->p_atlas->tiles );
+            output->p_atlas->i_decoders = 0;
+        }
+        if( output->p_atlas )
+            output->p_atlas->i_decoders++;
+        p_sys->p_atlas = output->p_atlas;
+    }
+    DrcsMapInit( &p_sys->drcs_drawing );
+    p_sys->pp_drawing = NULL;
+    p_sys->i_drawing = 0;
+    ArenaInit( &p_sys->drawing_arena );
+
     p_sys->i_subtitle_data_size = 0;
     p_sys->psz_subtitle_data = NULL;
     p_sys->b_ignore_ruby = false;
 #ifdef ARIBSUB_GEN_DRCS_DATA
     p_sys->p_drcs_data = NULL;
 #endif //ARIBSUB_GEN_DRCS_DATA
-    p_sys->i_drcs_num = 0;
-
-    p_sys->p_drcs_conv = NULL;
+    drcs_table_init( &p_sys->drcs );
 
+    DrcsMapInit( &p_sys->drcs_saved );
+    DrcsMemoInit( &p_sys->drcs_memo );
     load_drcs_conversion_table( p_dec );
-
-    p_sys->outputfile = output;
+    p_sys->psz_data_dir = get_arib_data_dir( p_dec );
+    p_sys->b_data_dir_ready = false;
+    DrcsCatalogInit( &p_sys->drcs_catalog );
+    bool b_catalog = p_sys->psz_data_dir != NULL &&
+        DrcsCatalogLoad( &p_sys->drcs_catalog, p_sys->psz_data_dir ) == 0;
+    if( !( flags & ( DEC_DRCS_ATLAS | DEC_DRCS_DRAWING ) ) )
+    {
+        if( b_catalog )
+            load_catalog_drcs_images( p_dec );
+        else
+            load_saved_drcs_images( p_dec );
+        drcs_writer_start( p_dec );
+    }
+    DrcsSimilarInit( &p_sys->drcs_similar );
+    DrcsMapInit( &p_sys->drcs_guessed );
+    p_sys->similarfp = NULL;
+    if( flags & DEC_DRCS_SIMILAR )
+        load_similar_drcs_images( p_dec, b_catalog );
+
+    ArenaInit( &p_sys->arena );
+    ArenaInit( &p_sys->ass_arena );
+    p_sys->p_ass = NULL;
+
+    arib_initialize_decoder( &p_sys->arib_decoder_pristine, true );
+    p_sys->arib_decoder_pristine.p_drcs = &p_sys->drcs;
+    p_sys->arib_decoder_pristine.p_drcs_conv = &p_sys->drcs_conv;
+    p_sys->arib_decoder_pristine.p_arena = &p_sys->arena;
+    p_sys->arib_decoder_pristine.pf_resolve_drcs = resolve_drcs_glyph;
+    p_sys->arib_decoder_pristine.p_resolve_drcs_sys = p_dec;
+
+    p_sys->p_output = output;
     p_sys->inputfile = input;
-    if (debugflg)
+    if (flags & DEC_DEBUG)
     {
         char *debugfile;
         asprintf(&debugfile,"%s.asslog",p_sys->inputfile);
@@ -165,8 +329,24 @@ void *dec_close(void *p_this)
 
     decoder_sys_t *p_sys = p_dec->p_sys;
 
-    if (p_sys->outputfp) fclose(p_sys->outputfp);
+    if (p_sys->i_crc_errors > 0)
+        fprintf(stderr,"%d data groups dropped on CRC error\n",p_sys->i_crc_errors);
+    if (p_sys->i_parse_errors > 0)
+        fprintf(stderr,"%d data groups dropped on parse error\n",p_sys->i_parse_errors);
     if (p_sys->debugfp) fclose(p_sys->debugfp);
+    if (p_sys->similarfp) fclose(p_sys->similarfp);
+    /* the atlas of all the PIDs, once the last of them is done */
+    if (p_sys->p_atlas && --p_sys->p_atlas->i_decoders == 0) {
+        save_drcs_atlas(p_dec);
+        free_drcs_png_jobs(p_sys->p_atlas->p_first);
+        DrcsMapClean(&p_sys->p_atlas->tiles);
+        free(p_sys->p_atlas);
+        p_sys->p_output->p_atlas = NULL;
+    }
+    p_sys->p_atlas = NULL;
+    /* the catalog records the PNGs once they are all written */
+    drcs_writer_stop(p_dec);
+    save_drcs_catalog(p_dec);
 
     free_all(p_dec);
     free(p_sys);
@@ -207,10 +387,12 @@ static int Open( vlc_object_t *p_this )
 #ifdef ARIBSUB_GEN_DRCS_DATA
     p_sys->p_drcs_data = NULL;
 #endif //ARIBSUB_GEN_DRCS_DATA
-    p_sys->i_drcs_num = 0;
+    drcs_table_init( &p_sys->drcs );
 
-    p_sys->p_drcs_conv = NULL;
+    DrcsMapInit( &p_sys->drcs_saved );
+    DrcsMemoInit( &p_sys->drcs_memo );
     load_drcs_conversion_table( p_dec );
+    drcs_writer_start( p_dec );
 
     return VLC_SUCCESS;
 }
@@ -219,20 +401,36 @@ static void free_all( decoder_t *p_dec )
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
 
-    free( p_sys->psz_subtitle_data );
+    drcs_writer_stop( p_dec ); /* writes whatever is still queued */
+    DrcsCatalogClean( &p_sys->drcs_catalog );
+    DrcsSimilarClean( &p_sys->drcs_similar );
+    DrcsMapClean( &p_sys->drcs_guessed );
+    free( p_sys->psz_data_dir );
+    p_sys->psz_data_dir = NULL;
+    DrcsMapClean( &p_sys->drcs_drawing );
+    free( p_sys->pp_drawing );
+    p_sys->pp_drawing = NULL;
+    p_sys->i_drawing = 0;
+    ArenaClean( &p_sys->drawing_arena );
+
+    ArenaClean( &p_sys->arena );
+    ArenaClean( &p_sys->ass_arena );
     p_sys->psz_subtitle_data = NULL;
+#ifdef ARIBSUB_GEN_DRCS_DATA
+    p_sys->p_drcs_data = NULL;
+#endif //ARIBSUB_GEN_DRCS_DATA
+    p_sys->p_ass = NULL;
+
+    free( p_sys->management_cache.p_data );
+    free( p_sys->statement_cache.p_data );
 
     free( p_sys->psz_fontfamily );
     p_sys->psz_fontfamily = NULL;
 
-    drcs_conversion_t *p_drcs_conv = p_sys->p_drcs_conv;
-    while( p_drcs_conv != NULL )
-    {
-        drcs_conversion_t *p_next = p_drcs_conv->p_next;
-        free( p_drcs_conv );
-        p_drcs_conv = p_next;
-    }
-    p_sys->p_drcs_conv = NULL;
+    DrcsMapClean( &p_sys->drcs_conv );
+    DrcsMapClean( &p_sys->drcs_saved );
+    drcs_table_clean( &p_sys->drcs );
+    DrcsMemoClean( &p_sys->drcs_memo );
 }
 #if 0
 /*****************************************************************************
@@ -264,7 +462,7 @@ static subpicture_t *Decode( decoder_t *p_dec, block_t **pp_block )
     }
     p_block = *pp_block;
 
-    bs_init( &p_sys->bs, p_block->p_buffer, p_block->i_buffer );
+    bs64_init( &p_sys->bs, p_block->p_buffer, p_block->i_buffer );
 
     parse_arib_pes( p_dec );
 
@@ -357,7 +555,7 @@ static void create_arib_datadir( decoder_t *p_dec )
 static void load_drcs_conversion_table( decoder_t *p_dec )
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
-    p_sys->p_drcs_conv = NULL;
+    DrcsMapInit( &p_sys->drcs_conv );
 
     create_arib_basedir( p_dec );
 
@@ -368,285 +566,1061 @@ static void load_drcs_conversion_table( decoder_t *p_dec )
     }
 
     char* psz_conv_file;
+    char* psz_cache_file;
     if( asprintf( &psz_conv_file, "%s"DIR_SEP"drcs_conv.ini", psz_arib_base_dir ) < 0 )
     {
         psz_conv_file = NULL;
     }
+    if( asprintf( &psz_cache_file, "%s"DIR_SEP"drcs_conv.bin", psz_arib_base_dir ) < 0 )
+    {
+        psz_cache_file = NULL;
+    }
     free( psz_arib_base_dir );
-    if( psz_conv_file == NULL )
+    if( psz_conv_file == NULL || psz_cache_file == NULL )
     {
+        free( psz_conv_file );
+        free( psz_cache_file );
         return;
     }
 
-    FILE *fp = vlc_fopen( psz_conv_file, "r" );
+    /* the compiled form is only trusted for the very ini it came from */
+    struct stat st;
+    FILE *fp = NULL;
+    if( vlc_stat( psz_conv_file, &st ) == 0 &&
+        DrcsMapLoad( &p_sys->drcs_conv, psz_cache_file,
+                     st.st_size, st.st_mtime ) != 0 )
+    {
+        fp = vlc_fopen( psz_conv_file, "r" );
+    }
     free( psz_conv_file );
     if( fp == NULL )
     {
+        free( psz_cache_file );
         return;
     }
 
-    drcs_conversion_t *p_drcs_conv = NULL;
     char buf[256] = { 0 };
     while( fgets( buf, 256, fp ) != 0 )
     {
-        if( buf[0] == ';' || buf[0] == '#' ) // comment
+        uint8_t digest[DRCS_DIGEST_SIZE];
+        unsigned int code;
+        if( DrcsConvParseLine( buf, digest, &code ) == 0 )
         {
-            continue;
+            DrcsMapAdd( &p_sys->drcs_conv, digest, code );
         }
+    }
+
+    fclose( fp );
+
+    /* a read-only base dir only costs the next run a parse */
+    DrcsMapSave( &p_sys->drcs_conv, psz_cache_file, st.st_size, st.st_mtime );
+    free( psz_cache_file );
+}
+
+/* the digest of a <md5>.png of the data dir, -1 for other names */
+static int drcs_image_digest( uint8_t *p_digest, const char *psz_name )
+{
+    if( strlen( psz_name ) != 2 * DRCS_DIGEST_SIZE + 4 ||
+        strcmp( psz_name + 2 * DRCS_DIGEST_SIZE, ".png" ) != 0 )
+        return -1;
+    return DrcsDigestFromHex( p_digest, psz_name );
+}
+
+/* PNGs already in the data dir count as saved, they are never rewritten */
+static void load_saved_drcs_images( decoder_t *p_dec )
+{
+#ifdef HAVE_DIRENT_H
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    if( p_sys->psz_data_dir == NULL )
+    {
+        return;
+    }
+
+    DIR *p_dir = opendir( p_sys->psz_data_dir );
+    if( p_dir == NULL )
+    {
+        return;
+    }
+
+    struct dirent *p_entry;
+    while( ( p_entry = readdir( p_dir ) ) != NULL )
+    {
+        uint8_t digest[DRCS_DIGEST_SIZE];
+        if( drcs_image_digest( digest, p_entry->d_name ) == 0 )
+            DrcsMapAdd( &p_sys->drcs_saved, digest, 1 );
+    }
+    closedir( p_dir );
+#else
+    VLC_UNUSED(p_dec);
+#endif
+}
+
+/* with a catalog the data dir is not even listed: it knows what was written */
+static void load_catalog_drcs_images( decoder_t *p_dec )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    const drcs_catalog_t *p_cat = &p_sys->drcs_catalog;
+
+    for( unsigned int i = 0; i < p_cat->i_entries; i++ )
+    {
+        if( p_cat->p_entries[i].i_flags & DRCS_CATALOG_PNG )
+            DrcsMapAdd( &p_sys->drcs_saved, p_cat->p_entries[i].digest, 1 );
+    }
+}
+
+static void save_drcs_catalog( decoder_t *p_dec )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    if( p_sys->psz_data_dir == NULL || p_sys->drcs_catalog.i_entries == 0 )
+    {
+        return;
+    }
+    if( !p_sys->b_data_dir_ready )
+    {
+        create_arib_datadir( p_dec );
+        p_sys->b_data_dir_ready = true;
+    }
+    DrcsCatalogSave( &p_sys->drcs_catalog, p_sys->psz_data_dir );
+}
+
+static int compare_drcs_catalog_entries( const void *a, const void *b )
+{
+    const drcs_catalog_entry_t *p_a = *(const drcs_catalog_entry_t **)a;
+    const drcs_catalog_entry_t *p_b = *(const drcs_catalog_entry_t **)b;
+    if( p_a->i_count != p_b->i_count )
+        return p_a->i_count < p_b->i_count ? 1 : -1;
+    return memcmp( p_a->digest, p_b->digest, DRCS_DIGEST_SIZE );
+}
+
+/*
+ * The unmapped patterns of the catalog, most transmitted first, as
+ * drcs_conv.ini lines waiting for their code point: the first ones are
+ * where an ini entry fixes the most captions. i_max 0 lists them all.
+ */
+void dec_drcs_report( FILE *fp, int i_max )
+{
+    decoder_t dec;
+    decoder_sys_t *p_sys = calloc( 1, sizeof(*p_sys) );
+    if( p_sys == NULL )
+    {
+        return;
+    }
+    memset( &dec, 0, sizeof(dec) );
+    dec.p_sys = p_sys;
+
+    load_drcs_conversion_table( &dec );
+    DrcsCatalogInit( &p_sys->drcs_catalog );
+    p_sys->psz_data_dir = get_arib_data_dir( &dec );
 
-        char* p_ret = strchr( buf, '\n' );
-        if( p_ret != NULL )
+    const drcs_catalog_t *p_cat = &p_sys->drcs_catalog;
+    const drcs_catalog_entry_t **pp_unmapped = NULL;
+    unsigned int i_unmapped = 0;
+    if( p_sys->psz_data_dir != NULL &&
+        DrcsCatalogLoad( &p_sys->drcs_catalog, p_sys->psz_data_dir ) == 0 )
+    {
+        pp_unmapped = malloc( ( p_cat->i_entries + 1 ) * sizeof(*pp_unmapped) );
+    }
+    if( pp_unmapped != NULL )
+    {
+        /* against the table of today, not the one of the run that saw it */
+        for( unsigned int i = 0; i < p_cat->i_entries; i++ )
         {
-            *p_ret = '\0';
+            if( DrcsConvGet( &p_sys->drcs_conv, p_cat->p_entries[i].digest ) == 0 )
+                pp_unmapped[i_unmapped++] = &p_cat->p_entries[i];
         }
+        qsort( pp_unmapped, i_unmapped, sizeof(*pp_unmapped),
+               compare_drcs_catalog_entries );
+    }
+
+    fprintf( fp, "; %u unmapped DRCS of %u in the catalog\n",
+             i_unmapped, p_cat->i_entries );
+    for( unsigned int i = 0; i < i_unmapped && ( i_max <= 0 || i < (unsigned)i_max ); i++ )
+    {
+        const drcs_catalog_entry_t *p_entry = pp_unmapped[i];
+        char psz_hash[2 * DRCS_DIGEST_SIZE + 1];
+        fprintf( fp, "; #%u %u times, %ux%u, first seen in %s\n%s=U+\n",
+                 i + 1, p_entry->i_count, p_entry->i_width, p_entry->i_height,
+                 p_entry->psz_first ? p_entry->psz_first : "?",
+                 DrcsDigestToHex( psz_hash, p_entry->digest ) );
+    }
+
+    free( pp_unmapped );
+    DrcsCatalogClean( &p_sys->drcs_catalog );
+    DrcsMapClean( &p_sys->drcs_conv );
+    free( p_sys->psz_data_dir );
+    free( p_sys );
+}
+
+/*
+ * Only called for patterns missing from drcs_saved, so the file is not
+ * looked for first; should another run have written it meanwhile, it is
+ * named after its content and rewriting it changes nothing.
+ */
+static FILE* open_image_file( decoder_t* p_dec, const char *psz_hash )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    if( !p_sys->b_data_dir_ready )
+    {
+        create_arib_datadir( p_dec );
+        p_sys->b_data_dir_ready = true;
+    }
+    if( p_sys->psz_data_dir == NULL )
+    {
+        return NULL;
+    }
+
+    char* psz_image_file;
+    if( asprintf( &psz_image_file, "%s"DIR_SEP"%s.png", p_sys->psz_data_dir, psz_hash ) < 0 )
+    {
+        return NULL;
+    }
+
+    FILE* fp = vlc_fopen( psz_image_file, "wb" );
+    if( fp == NULL )
+    {
+        // ERROR
+    }
+
+    free( psz_image_file );
+    return fp;
+}
+
+/*
+ * The digests of glyphs about to be shown. Retransmitted patterns are found
+ * in the memo, the others hashed by BatchMD5. Glyphs are resolved as the
+ * captions first use them, so this is called for one at a time.
+ */
+static int get_drcs_pattern_data_hashes( decoder_t *p_dec,
+        drcs_glyph_t **pp_glyph, unsigned int i_count )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    const void **pp_data = ArenaAlloc( &p_sys->arena, i_count * sizeof(*pp_data) );
+    size_t *pi_size = ArenaAlloc( &p_sys->arena, i_count * sizeof(*pi_size) );
+    uint64_t *pi_memo_hash = ArenaAlloc( &p_sys->arena,
+            i_count * sizeof(*pi_memo_hash) );
+    unsigned int *pi_index = ArenaAlloc( &p_sys->arena, i_count * sizeof(*pi_index) );
+    uint8_t (*p_new)[DRCS_DIGEST_SIZE] = ArenaAlloc( &p_sys->arena,
+            i_count * sizeof(*p_new) );
+    unsigned int i_new = 0;
+    if( !pp_data || !pi_size || !pi_memo_hash || !pi_index || !p_new )
+    {
+        return -1;
+    }
 
-        char *p_eq = strchr( buf, '=' );
-        if( p_eq == NULL || p_eq - buf != 32 )
+    for( unsigned int i = 0; i < i_count; i++ )
+    {
+        const drcs_glyph_t *p = pp_glyph[i];
+        pi_memo_hash[i] = DrcsMemoHash( p->i_width, p->i_height, p->i_depth,
+                (const uint8_t *)p->p_pattern, p->i_pattern );
+        const uint8_t *p_memo = DrcsMemoGet( &p_sys->drcs_memo, pi_memo_hash[i],
+                p->i_width, p->i_height, p->i_depth,
+                (const uint8_t *)p->p_pattern, p->i_pattern );
+        if( p_memo != NULL )
         {
+            memcpy( pp_glyph[i]->digest, p_memo, DRCS_DIGEST_SIZE );
             continue;
         }
-        char *p_code = strstr( buf, "U+" );
-        if( p_code == NULL || strlen( p_code ) < 2 || strlen( p_code ) > 8 )
+        pp_data[i_new] = p->p_pattern;
+        pi_size[i_new] = p->i_pattern;
+        pi_index[i_new++] = i;
+    }
+
+    BatchMD5( pp_data, pi_size, i_new, p_new );
+
+    for( unsigned int i = 0; i < i_new; i++ )
+    {
+        drcs_glyph_t *p = pp_glyph[pi_index[i]];
+        memcpy( p->digest, p_new[i], DRCS_DIGEST_SIZE );
+        /* the same pattern may be under two codes */
+        if( DrcsMemoGet( &p_sys->drcs_memo, pi_memo_hash[pi_index[i]],
+                    p->i_width, p->i_height, p->i_depth,
+                    (const uint8_t *)p->p_pattern, p->i_pattern ) == NULL )
+            DrcsMemoAdd( &p_sys->drcs_memo, pi_memo_hash[pi_index[i]],
+                    p->i_width, p->i_height, p->i_depth,
+                    (const uint8_t *)p->p_pattern, p->i_pattern, p_new[i] );
+    }
+    return 0;
+}
+
+/* data/<md5>.png, encoded in memory and written with a single write() */
+static int save_drcs_pattern_data_image(
+        decoder_t *p_dec,
+        const char* psz_hash,
+        int i_width, int i_height,
+        int i_depth, const int8_t* p_patternData )
+{
+    uint8_t *p_data;
+    size_t i_size;
+    int i_ret = -1;
+
+    if( DrcsPngEncode( &p_data, &i_size, i_width, i_height, i_depth,
+                       p_patternData ) )
+    {
+        return -1;
+    }
+
+    FILE *fp = open_image_file( p_dec, psz_hash );
+    if( fp != NULL )
+    {
+        setvbuf( fp, NULL, _IONBF, 0 );
+        if( fwrite( p_data, 1, i_size, fp ) == i_size )
+            i_ret = 0;
+        if( fclose( fp ) != 0 )
+            i_ret = -1;
+    }
+    free( p_data );
+    return i_ret;
+}
+
+static void drcs_writer_write( decoder_t *p_dec, drcs_png_job_t *p_job )
+{
+    drcs_writer_t *p_writer = &p_dec->p_sys->drcs_writer;
+
+    while( p_job != NULL )
+    {
+        drcs_png_job_t *p_next = p_job->p_next;
+        if( save_drcs_pattern_data_image( p_dec, p_job->psz_hash,
+                p_job->i_width, p_job->i_height, p_job->i_depth,
+                p_job->p_patternData ) == 0 )
         {
-            continue;
+            p_job->p_next = p_writer->p_written;
+            p_writer->p_written = p_job;
         }
+        else
+            free( p_job );
+        p_job = p_next;
+    }
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *drcs_writer_thread( void *data )
+{
+    decoder_t *p_dec = (decoder_t *)data;
+    drcs_writer_t *p_writer = &p_dec->p_sys->drcs_writer;
+
+    for( ;; )
+    {
+        pthread_mutex_lock( &p_writer->lock );
+        while( p_writer->p_first == NULL && !p_writer->b_quit )
+            pthread_cond_wait( &p_writer->wait, &p_writer->lock );
+        drcs_png_job_t *p_job = p_writer->p_first;
+        p_writer->p_first = NULL;
+        p_writer->pp_last = &p_writer->p_first;
+        pthread_mutex_unlock( &p_writer->lock );
+
+        if( p_job == NULL )
+            break; /* asked to quit with nothing left */
+        drcs_writer_write( p_dec, p_job );
+    }
+    return NULL;
+}
+#endif
+
+static void drcs_writer_start( decoder_t *p_dec )
+{
+    drcs_writer_t *p_writer = &p_dec->p_sys->drcs_writer;
+
+    p_writer->b_running = false;
+    p_writer->b_quit = false;
+    p_writer->p_first = NULL;
+    p_writer->pp_last = &p_writer->p_first;
+    p_writer->p_written = NULL;
+#ifdef HAVE_PTHREAD_H
+    if( pthread_mutex_init( &p_writer->lock, NULL ) != 0 )
+        return;
+    if( pthread_cond_init( &p_writer->wait, NULL ) != 0 )
+    {
+        pthread_mutex_destroy( &p_writer->lock );
+        return;
+    }
+    if( pthread_create( &p_writer->thread, NULL, drcs_writer_thread, p_dec ) != 0 )
+    {
+        pthread_cond_destroy( &p_writer->wait );
+        pthread_mutex_destroy( &p_writer->lock );
+        return;
+    }
+    p_writer->b_running = true;
+#endif
+}
+
+/* a failed write leaves the flag unset, the next run writes it again */
+static void drcs_writer_stop( decoder_t *p_dec )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    drcs_writer_t *p_writer = &p_sys->drcs_writer;
+#ifdef HAVE_PTHREAD_H
+    if( p_writer->b_running )
+    {
+        pthread_mutex_lock( &p_writer->lock );
+        p_writer->b_quit = true;
+        pthread_cond_signal( &p_writer->wait );
+        pthread_mutex_unlock( &p_writer->lock );
+        pthread_join( p_writer->thread, NULL );
+        pthread_cond_destroy( &p_writer->wait );
+        pthread_mutex_destroy( &p_writer->lock );
+    }
+#endif
+    p_writer->b_running = false;
+
+    drcs_png_job_t *p_job = p_writer->p_written;
+    p_writer->p_written = NULL;
+    while( p_job != NULL )
+    {
+        drcs_png_job_t *p_next = p_job->p_next;
+        uint8_t digest[DRCS_DIGEST_SIZE];
+        drcs_catalog_entry_t *p_entry = NULL;
+        if( DrcsDigestFromHex( digest, p_job->psz_hash ) == 0 )
+            p_entry = DrcsCatalogGet( &p_sys->drcs_catalog, digest );
+        if( p_entry != NULL )
+            DrcsCatalogSetFlags( p_entry, p_entry->i_flags | DRCS_CATALOG_PNG );
+        free( p_job );
+        p_job = p_next;
+    }
+}
+
+/* the pattern is copied, it lives in the arena of the current PES */
+static drcs_png_job_t *drcs_png_job_new( const char *psz_hash,
+        int i_width, int i_height, int i_depth, const int8_t *p_patternData )
+{
+    int i_bits_per_pixel = ceil( sqrt( ( i_depth ) ) );
+    size_t i_size = i_width * i_height * i_bits_per_pixel / 8;
+
+    drcs_png_job_t *p_job = malloc( sizeof(*p_job) + i_size );
+    if( p_job == NULL )
+        return NULL;
+    p_job->p_next = NULL;
+    memcpy( p_job->psz_hash, psz_hash, sizeof(p_job->psz_hash) );
+    p_job->i_width = i_width;
+    p_job->i_height = i_height;
+    p_job->i_depth = i_depth;
+    memcpy( p_job->p_patternData, p_patternData, i_size );
+    return p_job;
+}
 
-        char hash[32 + 1];
-        strncpy( hash, buf, 32 );
-        hash[32] = '\0';
-        unsigned long code = strtoul( p_code + 2, NULL, 16 );
-        if( code > 0x10ffff )
+static void free_drcs_png_jobs( drcs_png_job_t *p_job )
+{
+    while( p_job != NULL )
+    {
+        drcs_png_job_t *p_next = p_job->p_next;
+        free( p_job );
+        p_job = p_next;
+    }
+}
+
+static void drcs_writer_push( decoder_t *p_dec, drcs_png_job_t *p_job )
+{
+    drcs_writer_t *p_writer = &p_dec->p_sys->drcs_writer;
+
+    if( !p_writer->b_running )
+    {
+        drcs_writer_write( p_dec, p_job );
+        return;
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock( &p_writer->lock );
+    *p_writer->pp_last = p_job;
+    p_writer->pp_last = &p_job->p_next;
+    pthread_cond_signal( &p_writer->wait );
+    pthread_mutex_unlock( &p_writer->lock );
+#endif
+}
+
+/* one pixel per byte, 1 where the pattern is set */
+static void unpack_drcs_pattern( png_bytep p_dst, size_t i_stride,
+        int i_width, int i_height, int i_depth, const int8_t *p_patternData )
+{
+    int i_bits_per_pixel = ceil( sqrt( ( i_depth ) ) );
+
+    bs64_t bs;
+    bs64_init( &bs, p_patternData, i_width * i_height * i_bits_per_pixel / 8 );
+
+    for( int j = 0; j < i_height; j++ )
+    {
+        for( int i = 0; i < i_width; i++ )
         {
-            continue;
+            uint8_t i_pxl = bs64_read( &bs, i_bits_per_pixel );
+            p_dst[j * i_stride + i] = i_pxl ? 1 : 0;
         }
+    }
+}
+
+/*
+ * DEC_DRCS_ATLAS: every unknown glyph of the run, whatever its PID, as a
+ * tile of one <input>.drcs.png, row by row in order of appearance, and a
+ * <input>.drcs.ini listing the MD5 of each tile as a drcs_conv.ini line
+ * waiting for its code point.
+ */
+#define DRCS_ATLAS_COLUMNS 16
+
+/* kept apart from save_drcs_atlas so that nothing around setjmp changes */
+static void write_drcs_atlas_image( FILE *fp, const drcs_atlas_t *p_atlas,
+        int i_columns, int i_rows, int i_tile_width, int i_tile_height )
+{
+    int i_width = i_columns * i_tile_width;
 
-        drcs_conversion_t *p_next = (drcs_conversion_t*) malloc(
-                sizeof(drcs_conversion_t) );
-        if( p_next == NULL )
+    /* one row of tiles at a time */
+    png_bytep p_band = malloc( (size_t)i_width * i_tile_height );
+    if( p_band == NULL )
+    {
+        return;
+    }
+
+    png_structp png_ptr = png_create_write_struct(
+            PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
+    if( png_ptr == NULL )
+    {
+        goto png_create_write_struct_failed;
+    }
+    png_infop info_ptr = png_create_info_struct( png_ptr );
+    if( info_ptr == NULL )
+    {
+        goto png_create_info_struct_failed;
+    }
+
+    if( setjmp( png_jmpbuf( png_ptr ) ) )
+    {
+        goto png_failure;
+    }
+
+    png_set_IHDR( png_ptr,
+            info_ptr,
+            i_width,
+            i_rows * i_tile_height,
+            1,
+            PNG_COLOR_TYPE_PALETTE,
+            PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_DEFAULT,
+            PNG_FILTER_TYPE_DEFAULT );
+
+    png_byte trans_values[1];
+    trans_values[0] = (png_byte)0;
+    png_set_tRNS( png_ptr, info_ptr, trans_values, 1, NULL );
+
+    png_color palette[2] =
+    {
+        { 255, 255, 255 }, /* background */
+        {   0,   0,   0 }, /* foreground */
+    };
+    png_set_PLTE( png_ptr, info_ptr, palette, 2 );
+
+    png_init_io( png_ptr, fp );
+    png_write_info( png_ptr, info_ptr );
+    png_set_packing( png_ptr );
+
+    const drcs_png_job_t *p_job = p_atlas->p_first;
+    for( int r = 0; r < i_rows; r++ )
+    {
+        memset( p_band, 0, (size_t)i_width * i_tile_height );
+        for( int c = 0; c < i_columns && p_job != NULL; c++, p_job = p_job->p_next )
         {
-            continue;
+            unpack_drcs_pattern( p_band + c * i_tile_width, i_width,
+                    p_job->i_width, p_job->i_height, p_job->i_depth,
+                    p_job->p_patternData );
         }
-        strncpy( p_next->hash, hash, 32 );
-        p_next->hash[32] = '\0';
-        p_next->code = code;
-        if( p_drcs_conv == NULL )
+        for( int j = 0; j < i_tile_height; j++ )
         {
-            p_sys->p_drcs_conv = p_next;
+            png_write_row( png_ptr, p_band + (size_t)j * i_width );
         }
-        else
+    }
+    png_write_end( png_ptr, info_ptr );
+
+png_failure:
+png_create_info_struct_failed:
+    png_destroy_write_struct( &png_ptr, &info_ptr );
+png_create_write_struct_failed:
+    free( p_band );
+}
+
+static void save_drcs_atlas( decoder_t *p_dec )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    const drcs_atlas_t *p_atlas = p_sys->p_atlas;
+    if( p_atlas == NULL || p_atlas->i_count == 0 )
+    {
+        return;
+    }
+
+    int i_tile_width = 0, i_tile_height = 0;
+    for( drcs_png_job_t *p_job = p_atlas->p_first; p_job; p_job = p_job->p_next )
+    {
+        i_tile_width = __MAX( i_tile_width, p_job->i_width );
+        i_tile_height = __MAX( i_tile_height, p_job->i_height );
+    }
+    int i_columns = __MIN( p_atlas->i_count, DRCS_ATLAS_COLUMNS );
+    int i_rows = ( p_atlas->i_count + i_columns - 1 ) / i_columns;
+
+    char *psz_image_file, *psz_list_file;
+    if( asprintf( &psz_image_file, "%s.drcs.png", p_sys->inputfile ) < 0 )
+    {
+        return;
+    }
+    if( asprintf( &psz_list_file, "%s.drcs.ini", p_sys->inputfile ) < 0 )
+    {
+        free( psz_image_file );
+        return;
+    }
+
+    FILE *fp = vlc_fopen( psz_list_file, "w" );
+    if( fp != NULL )
+    {
+        fprintf( fp, "; %s: %d tiles of %dx%d, %d per row\n",
+                 psz_image_file, p_atlas->i_count,
+                 i_tile_width, i_tile_height, i_columns );
+        int i = 0;
+        for( drcs_png_job_t *p_job = p_atlas->p_first; p_job; p_job = p_job->p_next, i++ )
+        {
+            fprintf( fp, "; tile %d row %d column %d (%dx%d)\n%s=U+\n",
+                     i, i / i_columns, i % i_columns,
+                     p_job->i_width, p_job->i_height, p_job->psz_hash );
+        }
+        fclose( fp );
+    }
+    free( psz_list_file );
+
+    fp = vlc_fopen( psz_image_file, "wb" );
+    free( psz_image_file );
+    if( fp == NULL )
+    {
+        return;
+    }
+    write_drcs_atlas_image( fp, p_atlas, i_columns, i_rows,
+                            i_tile_width, i_tile_height );
+    fclose( fp );
+}
+
+/*
+ * DEC_DRCS_DRAWING: the pattern as an ASS drawing in pattern pixels. Runs
+ * of set pixels are merged with the identical runs of the rows below into
+ * rectangles, so a stroke costs one rectangle rather than one per row. The
+ * leading moves span the whole cell, for renderers that place a drawing by
+ * its bounding box. NULL if the drawing would be too long to be worth it.
+ */
+#define DRCS_DRAWING_MAX    8192
+
+typedef struct
+{
+    int i_x0, i_x1, i_y0;
+} drcs_rect_t;
+
+/* appends the rectangle closed at row y, DRCS_DRAWING_MAX once full */
+static int drcs_drawing_rect( char *psz_drawing, int i_len,
+                              const drcs_rect_t *p_rect, int y )
+{
+    if( i_len >= DRCS_DRAWING_MAX )
+        return DRCS_DRAWING_MAX;
+    i_len += snprintf( &psz_drawing[i_len], DRCS_DRAWING_MAX - i_len,
+                       " m %d %d l %d %d %d %d %d %d",
+                       p_rect->i_x0, p_rect->i_y0, p_rect->i_x1, p_rect->i_y0,
+                       p_rect->i_x1, y, p_rect->i_x0, y );
+    return i_len < DRCS_DRAWING_MAX ? i_len : DRCS_DRAWING_MAX;
+}
+
+static char *build_drcs_drawing( arena_t *p_arena,
+        int i_width, int i_height, int i_depth, const int8_t *p_patternData )
+{
+    drcs_rect_t open[128], next[128];
+    int i_open = 0;
+    char psz_drawing[DRCS_DRAWING_MAX];
+    int i_len;
+
+    uint8_t *p_pixels = malloc( i_width * i_height );
+    if( p_pixels == NULL )
+        return NULL;
+    unpack_drcs_pattern( p_pixels, i_width,
+            i_width, i_height, i_depth, p_patternData );
+
+    i_len = snprintf( psz_drawing, sizeof(psz_drawing),
+                      "m 0 0 m %d %d", i_width, i_height );
+
+    /* one row past the end closes every rectangle still open */
+    for( int y = 0; y <= i_height; y++ )
+    {
+        const uint8_t *p_row = &p_pixels[y * i_width];
+        int i_next = 0;
+        int k = 0;
+        int x = 0;
+
+        while( y < i_height && x < i_width )
         {
-            p_drcs_conv->p_next = p_next;
+            if( !p_row[x] )
+            {
+                x++;
+                continue;
+            }
+            int i_x0 = x;
+            while( x < i_width && p_row[x] )
+                x++;
+
+            while( k < i_open && open[k].i_x0 <= i_x0 )
+            {
+                if( open[k].i_x0 == i_x0 && open[k].i_x1 == x )
+                    break;
+                i_len = drcs_drawing_rect( psz_drawing, i_len, &open[k++], y );
+            }
+            if( k < i_open && open[k].i_x0 == i_x0 )
+            {
+                next[i_next++] = open[k++];     /* same run, taller rectangle */
+            }
+            else
+            {
+                next[i_next].i_x0 = i_x0;
+                next[i_next].i_x1 = x;
+                next[i_next].i_y0 = y;
+                i_next++;
+            }
         }
-        p_drcs_conv = p_next;
-        p_drcs_conv->p_next = NULL;
+        for( ; k < i_open; k++ )
+            i_len = drcs_drawing_rect( psz_drawing, i_len, &open[k], y );
+        memcpy( open, next, i_next * sizeof(*next) );
+        i_open = i_next;
     }
+    free( p_pixels );
 
-    fclose( fp );
-
+    if( i_len >= DRCS_DRAWING_MAX )
+        return NULL;
+    return ArenaPrintf( p_arena, "%s", psz_drawing );
 }
 
-static FILE* open_image_file( decoder_t* p_dec, const char *psz_hash )
+/* built once per pattern, then shared by every code it is defined for */
+static const char *get_drcs_drawing( decoder_t *p_dec, const uint8_t *p_digest,
+        int i_width, int i_height, int i_depth, const int8_t *p_patternData )
 {
-    FILE* fp = NULL;
-    create_arib_datadir( p_dec );
+    decoder_sys_t *p_sys = p_dec->p_sys;
 
-    char *psz_arib_data_dir = get_arib_data_dir( p_dec );
-    if( psz_arib_data_dir == NULL )
+    unsigned int i_index = DrcsMapGet( &p_sys->drcs_drawing, p_digest );
+    if( i_index != 0 )
+        return p_sys->pp_drawing[i_index - 1];
+
+    const char *psz_drawing = build_drcs_drawing( &p_sys->drawing_arena,
+            i_width, i_height, i_depth, p_patternData );
+    const char **pp_new = realloc( p_sys->pp_drawing,
+            ( p_sys->i_drawing + 1 ) * sizeof(*pp_new) );
+    if( pp_new == NULL )
+        return psz_drawing;
+    p_sys->pp_drawing = pp_new;
+    p_sys->pp_drawing[p_sys->i_drawing++] = psz_drawing;
+    DrcsMapAdd( &p_sys->drcs_drawing, p_digest, p_sys->i_drawing );
+    return psz_drawing;
+}
+
+/*
+ * data/<hash>.png back to a 1 bpp bitmap, ink being the opaque dark pixels
+ * as written by save_drcs_pattern_data_image(); NULL if it cannot be read.
+ */
+static uint8_t *read_drcs_image( decoder_t *p_dec, const char *psz_hash,
+                                 int *pi_width, int *pi_height )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    char *psz_image_file;
+    if( asprintf( &psz_image_file, "%s"DIR_SEP"%s.png", p_sys->psz_data_dir, psz_hash ) < 0 )
+    {
+        return NULL;
+    }
+    FILE *fp = vlc_fopen( psz_image_file, "rb" );
+    free( psz_image_file );
+    if( fp == NULL )
     {
         return NULL;
     }
 
-    char* psz_image_file;
-    if( asprintf( &psz_image_file, "%s"DIR_SEP"%s.png", psz_arib_data_dir, psz_hash ) < 0 )
+    uint8_t *volatile p_bits = NULL;
+    png_bytep volatile p_row = NULL;
+    png_structp png_ptr = png_create_read_struct(
+            PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
+    png_infop info_ptr = png_ptr ? png_create_info_struct( png_ptr ) : NULL;
+    if( info_ptr == NULL )
     {
-        psz_image_file = NULL;
+        goto end;
     }
-    free( psz_arib_data_dir );
-    if( psz_image_file == NULL )
+    if( setjmp( png_jmpbuf( png_ptr ) ) )
     {
-        return NULL;
+        free( p_bits );
+        p_bits = NULL;
+        goto end;
     }
 
-    struct stat st;
-    int ret = vlc_stat( psz_image_file, &st );
-    if( ret < 0 || ( !S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode) ) )
+    png_init_io( png_ptr, fp );
+    png_read_info( png_ptr, info_ptr );
+    png_uint_32 i_width = png_get_image_width( png_ptr, info_ptr );
+    png_uint_32 i_height = png_get_image_height( png_ptr, info_ptr );
+    if( i_width == 0 || i_width > 255 || i_height == 0 || i_height > 255 ||
+        png_get_interlace_type( png_ptr, info_ptr ) != PNG_INTERLACE_NONE )
+    {
+        goto end;
+    }
+
+    /* whatever the format, read as 8-bit RGBA */
+    png_set_expand( png_ptr );
+    png_set_strip_16( png_ptr );
+    png_set_gray_to_rgb( png_ptr );
+    png_set_add_alpha( png_ptr, 0xff, PNG_FILLER_AFTER );
+    png_read_update_info( png_ptr, info_ptr );
+    if( png_get_rowbytes( png_ptr, info_ptr ) != 4 * i_width )
+    {
+        goto end;
+    }
+
+    p_row = malloc( 4 * i_width );
+    p_bits = calloc( ( i_width * i_height + 7 ) / 8, 1 );
+    if( p_row == NULL || p_bits == NULL )
+    {
+        free( p_bits );
+        p_bits = NULL;
+        goto end;
+    }
+    for( png_uint_32 y = 0; y < i_height; y++ )
     {
-        fp = vlc_fopen( psz_image_file, "wb" );
-        if( fp == NULL )
+        png_read_row( png_ptr, p_row, NULL );
+        for( png_uint_32 x = 0; x < i_width; x++ )
         {
-            // ERROR
+            const png_byte *p = &p_row[4 * x];
+            size_t k = (size_t)y * i_width + x;
+            if( p[3] >= 128 && p[0] + p[1] + p[2] < 3 * 128 )
+                p_bits[k / 8] |= 0x80 >> ( k % 8 );
         }
     }
+    *pi_width = i_width;
+    *pi_height = i_height;
 
-    free( psz_image_file );
-    return fp;
+end:
+    png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+    free( p_row );
+    fclose( fp );
+    return p_bits;
 }
 
-static char* get_drcs_pattern_data_hash(
-        decoder_t *p_dec,
-        int i_width, int i_height,
-        int i_depth, const int8_t* p_patternData )
+static int fingerprint_drcs_pattern( uint64_t *p_fp, const drcs_glyph_t *p_glyph )
 {
-    VLC_UNUSED(p_dec);
-    int i_bits_per_pixel = ceil( sqrt( ( i_depth ) ) );
-    struct md5_s md5;
-    InitMD5( &md5 );
-    AddMD5( &md5, p_patternData, i_width * i_height * i_bits_per_pixel / 8 );
-    EndMD5( &md5 );
-    return psz_md5_hash( &md5 );
+    uint8_t *p_bits = malloc( ( (size_t)p_glyph->i_width * p_glyph->i_height + 7 ) / 8 );
+    if( p_bits == NULL )
+    {
+        return -1;
+    }
+    DrcsPackPattern( p_bits, p_glyph->i_width, p_glyph->i_height,
+                     p_glyph->i_depth, p_glyph->p_pattern );
+    DrcsFingerprint( p_fp, p_bits, p_glyph->i_width, p_glyph->i_height );
+    free( p_bits );
+    return 0;
 }
 
-static void save_drcs_pattern_data_image(
-        decoder_t *p_dec,
-        const char* psz_hash,
-        int i_width, int i_height,
-        int i_depth, const int8_t* p_patternData )
+static void add_similar_drcs_image( decoder_t *p_dec, const uint8_t *p_digest )
 {
-    FILE *fp = open_image_file( p_dec, psz_hash );
-    if( fp == NULL )
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    unsigned int i_code = DrcsConvGet( &p_sys->drcs_conv, p_digest );
+    if( i_code == 0 )
     {
         return;
     }
 
-    png_structp png_ptr = png_create_write_struct(
-            PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
-    if( png_ptr == NULL )
+    char psz_hash[32 + 1];
+    int i_width, i_height;
+    uint8_t *p_bits = read_drcs_image( p_dec, DrcsDigestToHex( psz_hash, p_digest ),
+                                       &i_width, &i_height );
+    if( p_bits == NULL )
     {
-        goto png_create_write_struct_failed;
+        return;
     }
-    png_infop info_ptr = png_create_info_struct( png_ptr );
-    if( info_ptr == NULL )
+    uint64_t fp[DRCS_SIMILAR_WORDS];
+    DrcsFingerprint( fp, p_bits, i_width, i_height );
+    free( p_bits );
+    DrcsSimilarAdd( &p_sys->drcs_similar, p_digest, fp, i_code );
+}
+
+/*
+ * DEC_DRCS_SIMILAR: the PNGs of the data dir that drcs_conv.ini has given a
+ * code point since they were written are what unknown glyphs are compared
+ * with; the mapped glyphs met while decoding join them as they come.
+ */
+static void load_similar_drcs_images( decoder_t *p_dec, bool b_catalog )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    if( p_sys->psz_data_dir == NULL )
     {
-        goto png_create_info_struct_failed;
+        return;
     }
 
-    if( setjmp( png_jmpbuf( png_ptr ) ) )
+    if( b_catalog )
     {
-        goto png_failure;
+        const drcs_catalog_t *p_cat = &p_sys->drcs_catalog;
+        for( unsigned int i = 0; i < p_cat->i_entries; i++ )
+        {
+            if( p_cat->p_entries[i].i_flags & DRCS_CATALOG_PNG )
+                add_similar_drcs_image( p_dec, p_cat->p_entries[i].digest );
+        }
+        return;
     }
 
-    png_set_IHDR( png_ptr,
-            info_ptr,
-            i_width,
-            i_height,
-            1,
-            PNG_COLOR_TYPE_PALETTE,
-            PNG_INTERLACE_NONE,
-            PNG_COMPRESSION_TYPE_DEFAULT,
-            PNG_FILTER_TYPE_DEFAULT );
-
-    png_bytepp pp_image;
-    pp_image = png_malloc( png_ptr, i_height * sizeof(png_bytep) );
-    for( int j = 0; j < i_height; j++ )
+#ifdef HAVE_DIRENT_H
+    DIR *p_dir = opendir( p_sys->psz_data_dir );
+    if( p_dir == NULL )
     {
-        pp_image[j] = png_malloc( png_ptr, i_width * sizeof(png_byte) );
+        return;
     }
+    struct dirent *p_entry;
+    while( ( p_entry = readdir( p_dir ) ) != NULL )
+    {
+        uint8_t digest[DRCS_DIGEST_SIZE];
+        if( drcs_image_digest( digest, p_entry->d_name ) == 0 )
+            add_similar_drcs_image( p_dec, digest );
+    }
+    closedir( p_dir );
+#endif
+}
 
+/*
+ * DEC_DRCS_SIMILAR: a mapped glyph (i_code) joins the references, an
+ * unknown one gets the code point of its look-alike, 0 if it has none.
+ * Each guess is logged once to <input>.drcs_similar.ini, as a
+ * drcs_conv.ini line to be checked.
+ */
+static unsigned int match_similar_drcs( decoder_t *p_dec,
+        const drcs_glyph_t *p_glyph, unsigned int i_code )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    uint64_t fp[DRCS_SIMILAR_WORDS];
 
-    int i_bits_per_pixel = ceil( sqrt( ( i_depth ) ) );
-
-    bs_t bs;
-    bs_init( &bs, p_patternData, i_width * i_height * i_bits_per_pixel / 8 );
-
-    for( int j = 0; j < i_height; j++ )
+    if( i_code != 0 )
     {
-        for( int i = 0; i < i_width; i++ )
-        {
-            uint8_t i_pxl = bs_read( &bs, i_bits_per_pixel );
-            pp_image[j][i] = i_pxl ? 1 : 0;
-        }
+        if( DrcsMapGet( &p_sys->drcs_similar.index, p_glyph->digest ) == 0 &&
+            fingerprint_drcs_pattern( fp, p_glyph ) == 0 )
+            DrcsSimilarAdd( &p_sys->drcs_similar, p_glyph->digest, fp, i_code );
+        return 0;
     }
 
-    png_byte trans_values[1];
-    trans_values[0] = (png_byte)0;
-    png_set_tRNS( png_ptr, info_ptr, trans_values, 1, NULL );
-
-    int colors[][3] =
+    unsigned int i_guess = DrcsMapGet( &p_sys->drcs_guessed, p_glyph->digest );
+    if( i_guess != 0 || p_sys->drcs_similar.i_count == 0 ||
+        fingerprint_drcs_pattern( fp, p_glyph ) )
     {
-        {255, 255, 255}, /* background */
-        {  0,   0,   0}, /* foreground */
-    };
-    png_color palette[2];
-    for( int i = 0; i < 2; i++ )
+        return i_guess;
+    }
+    unsigned int i_distance;
+    int i_ref = DrcsSimilarMatch( &p_sys->drcs_similar, fp, &i_distance );
+    if( i_ref < 0 )
     {
-        palette[i].red = colors[i][0];
-        palette[i].green = colors[i][1];
-        palette[i].blue = colors[i][2];
+        return 0;
     }
-    png_set_PLTE( png_ptr, info_ptr, palette, 2 );
-
-    png_init_io( png_ptr, fp );
-    png_write_info( png_ptr, info_ptr );
-    png_set_packing( png_ptr );
-    png_write_image( png_ptr, pp_image );
-    png_write_end( png_ptr, info_ptr );
+    i_guess = p_sys->drcs_similar.pi_code[i_ref];
+    DrcsMapAdd( &p_sys->drcs_guessed, p_glyph->digest, i_guess );
 
-    for( int j = 0; j < i_height; j++ )
+    if( p_sys->similarfp == NULL )
     {
-        png_free( png_ptr, pp_image[j] );
+        char *psz_list_file;
+        if( asprintf( &psz_list_file, "%s.drcs_similar.ini", p_sys->inputfile ) >= 0 )
+        {
+            p_sys->similarfp = vlc_fopen( psz_list_file, "w" );
+            free( psz_list_file );
+        }
     }
-    png_free( png_ptr, pp_image );
-
-png_failure:
-png_create_info_struct_failed:
-    png_destroy_write_struct( &png_ptr, &info_ptr );
-png_create_write_struct_failed:
-    fclose( fp );
+    if( p_sys->similarfp != NULL )
+    {
+        char psz_hash[32 + 1], psz_ref[32 + 1];
+        fprintf( p_sys->similarfp, "; %dx%d, like %s (%u of %d cells differ)\n%s=U+%x\n",
+                 p_glyph->i_width, p_glyph->i_height,
+                 DrcsDigestToHex( psz_ref, p_sys->drcs_similar.p_digest[i_ref] ),
+                 i_distance, DRCS_SIMILAR_GRID * DRCS_SIMILAR_GRID,
+                 DrcsDigestToHex( psz_hash, p_glyph->digest ), i_guess );
+    }
+    return i_guess;
 }
 
-static void save_drcs_pattern(
-        decoder_t *p_dec,
-        int i_width, int i_height,
-        int i_depth, const int8_t* p_patternData, uint16_t i_CharacterCode )
+static void save_drcs_pattern( decoder_t *p_dec, drcs_glyph_t *p_glyph )
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
-    drcs_conversion_t *p_drcs_conv;
+    const uint8_t *digest = p_glyph->digest;
+    int i_width = p_glyph->i_width;
+    int i_height = p_glyph->i_height;
+    int i_depth = p_glyph->i_depth;
+    const int8_t *p_patternData = p_glyph->p_pattern;
     bool found;
 
-/* XXX broken data ? */
-if (i_height == 0 || i_width == 0) return;
+    char psz_hash[32 + 1];
+    DrcsDigestToHex( psz_hash, digest );
 
-    char* psz_hash = get_drcs_pattern_data_hash( p_dec,
-            i_width, i_height, i_depth, p_patternData );
+    // has convert table? already saved?
+    unsigned int i_code = DrcsConvGet( &p_sys->drcs_conv, digest );
+    bool b_mapped = i_code != 0;
+    found = b_mapped;
+    if( p_sys->i_flags & DEC_DRCS_SIMILAR )
+    {
+        p_glyph->i_code = match_similar_drcs( p_dec, p_glyph, i_code );
+        found = found || p_glyph->i_code != 0;
+    }
 
-    found = false;
-    // has convert table?
-    p_drcs_conv = p_sys->p_drcs_conv;
-    while( p_drcs_conv != NULL && p_drcs_conv->hash) 
+    if( !found && ( p_sys->i_flags & DEC_DRCS_DRAWING ) )
     {
-        if (strcmp( p_drcs_conv->hash,psz_hash) == 0 )
-        {
-            found = true;
-            break;
-        }
-        p_drcs_conv = p_drcs_conv->p_next;
+        p_glyph->psz_drawing = get_drcs_drawing( p_dec, digest,
+                i_width, i_height, i_depth, p_patternData );
     }
-    // already saved?
-    if (!found) {
-        for(int i=0;i<DRCS_HASH_TABLE_SIZE;i++) {
-            if (strcmp(p_sys->drcs_hash_table[i],psz_hash) == 0)
+
+    /* drawn glyphs need no PNG, unless they also go to the atlas */
+    if( ( p_sys->i_flags & DEC_DRCS_DRAWING ) &&
+        !( p_sys->i_flags & DEC_DRCS_ATLAS ) )
+        found = true;
+    unsigned int i_saved = DrcsMapGet( &p_sys->drcs_saved, digest );
+    found = found || i_saved != 0;
+
+    drcs_catalog_entry_t *p_entry = DrcsCatalogSeen( &p_sys->drcs_catalog,
+            digest, i_width, i_height, i_depth, p_sys->inputfile );
+    uint8_t i_catalog_flags = p_entry ? p_entry->i_flags & DRCS_CATALOG_PNG : 0;
+    if( b_mapped )
+        i_catalog_flags |= DRCS_CATALOG_MAPPED;
+    if( i_saved == 1 )
+        i_catalog_flags |= DRCS_CATALOG_PNG;
+
+    /* drcs_saved is updated here, so a pattern is queued only once */
+    if (!found)
+    {
+        drcs_png_job_t *p_job = drcs_png_job_new( psz_hash,
+                i_width, i_height, i_depth, p_patternData );
+        if( p_job != NULL && ( p_sys->i_flags & DEC_DRCS_ATLAS ) )
+        {
+            drcs_atlas_t *p_atlas = p_sys->p_atlas;
+            /* another PID may have put it in already */
+            if( p_atlas != NULL && DrcsMapGet( &p_atlas->tiles, digest ) == 0 &&
+                DrcsMapAdd( &p_atlas->tiles, digest, 1 ) == 0 )
             {
-                found = true;
-                break;
+                *p_atlas->pp_last = p_job;
+                p_atlas->pp_last = &p_job->p_next;
+                p_atlas->i_count++;
             }
+            else
+                free( p_job );
         }
+        else if( p_job != NULL )
+            drcs_writer_push( p_dec, p_job );
+        DrcsMapAdd( &p_sys->drcs_saved, digest, 2 );
     }
+    if( p_entry != NULL )
+        DrcsCatalogSetFlags( p_entry, i_catalog_flags );
+}
 
+/*
+ * Called by the ARIB decoder when a caption first uses a glyph defined
+ * since: only then is the pattern hashed, looked up and saved.
+ */
+static void resolve_drcs_glyph( void *p_opaque, drcs_glyph_t *p_glyph )
+{
+    decoder_t *p_dec = p_opaque;
 
-    strncpy( p_sys->drcs_hash_table[p_sys->i_drcs_num], psz_hash, 32 );
-    p_sys->drcs_hash_table[p_sys->i_drcs_num][32] = '\0';
-    // XXX x4121??
-    p_sys->drcs_hash_code[p_sys->i_drcs_num] = i_CharacterCode - 0x4121;
+    if( get_drcs_pattern_data_hashes( p_dec, &p_glyph, 1 ) )
+        return;
+    p_glyph->b_pending = 0;
+    save_drcs_pattern( p_dec, p_glyph );
+}
 
-    p_sys->i_drcs_num++;
+static void define_drcs_pattern(
+        decoder_t *p_dec,
+        int i_width, int i_height,
+        int i_depth, const int8_t* p_patternData, int i_set, int i_code )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
 
-    if (!found)
-    {
-        save_drcs_pattern_data_image( p_dec, psz_hash,
-                i_width, i_height, i_depth, p_patternData );
-    }
+/* XXX broken data ? */
+if (i_height == 0 || i_width == 0) return;
 
-    free( psz_hash );
+    int i_bits_per_pixel = ceil( sqrt( ( i_depth ) ) );
+    drcs_table_define( &p_sys->drcs, i_set, i_code, i_width, i_height,
+            i_depth, p_patternData, i_width * i_height * i_bits_per_pixel / 8 );
 }
 
 static void parse_data_unit_staement_body( decoder_t *p_dec,
@@ -655,97 +1629,100 @@ static void parse_data_unit_staement_body( decoder_t *p_dec,
 {
     VLC_UNUSED(i_data_unit_parameter);
     decoder_sys_t *p_sys = p_dec->p_sys;
+    uint32_t i_copy = 0;
 
-    char* p_data_unit_data_byte = (char*) malloc(
-            sizeof(char) * (i_data_unit_size + 1) );
-    if( p_data_unit_data_byte == NULL )
-    {
-        return;
-    }
-    for( uint32_t i = 0; i < i_data_unit_size; i++ )
+    /* never write past the buffer sized from data_unit_loop_length */
+    if( p_sys->psz_subtitle_data != NULL )
+        i_copy = __MIN( i_data_unit_size,
+                p_sys->i_subtitle_data_max - p_sys->i_subtitle_data_size );
+
+    bs64_read_bytes( &p_sys->bs,
+            p_sys->psz_subtitle_data + p_sys->i_subtitle_data_size, i_copy );
+    bs64_skip_bytes( &p_sys->bs, i_data_unit_size - i_copy );
+    p_sys->i_subtitle_data_size += i_copy;
+}
+
+/*
+ * Registry index of a CharacterCode: a 1-byte DRCS code carries its set's
+ * final byte (0x41 for DRCS-1) above the character, a 2-byte one is a row
+ * and column of DRCS-0. -1 for codes outside the sets.
+ */
+static int drcs_code_index( uint8_t i_data_unit_parameter,
+        uint16_t i_CharacterCode, int *pi_set )
+{
+    int i_hi = ( i_CharacterCode >> 8 ) - 0x21;
+    int i_lo = ( i_CharacterCode & 0xff ) - 0x21;
+    if( i_lo < 0 || i_lo >= DRCS_CODES )
+        return -1;
+
+    if( i_data_unit_parameter == 0x31 )
     {
-        p_data_unit_data_byte[i] = bs_read( &p_sys->bs, 8 );
-        p_sys->i_data_unit_size += 1;
+        if( i_hi < 0 || i_hi >= DRCS_CODES )
+            return -1;
+        *pi_set = 0;
+        return i_hi * DRCS_CODES + i_lo;
     }
-    p_data_unit_data_byte[i_data_unit_size] = '\0';
 
-    memcpy( p_sys->psz_subtitle_data + p_sys->i_subtitle_data_size,
-            p_data_unit_data_byte, i_data_unit_size );
-    p_sys->i_subtitle_data_size += i_data_unit_size;
-
-    free( p_data_unit_data_byte );
+    *pi_set = ( i_CharacterCode >> 8 ) - 0x40;
+    if( *pi_set < 1 || *pi_set >= DRCS_SETS )
+        return -1;
+    return i_lo;
 }
 
-static void parse_data_unit_DRCS( decoder_t *p_dec,
+static bool parse_data_unit_DRCS( decoder_t *p_dec,
         uint8_t i_data_unit_parameter,
         uint32_t i_data_unit_size )
 {
-    VLC_UNUSED(i_data_unit_parameter); VLC_UNUSED(i_data_unit_size);
+    VLC_UNUSED(i_data_unit_size);
     decoder_sys_t *p_sys = p_dec->p_sys;
 
 #ifdef ARIBSUB_GEN_DRCS_DATA
-    if( p_sys->p_drcs_data != NULL )
-    {
-        for( int i = 0; i < p_sys->p_drcs_data->i_NumberOfCode; i++ )
-        {
-            drcs_code_t* p_drcs_code = &p_sys->p_drcs_data->p_drcs_code[i];
-            for( int j = 0; j < p_drcs_code->i_NumberOfFont ; j++ )
-            {
-                drcs_font_data_t *p_drcs_font_data =  &p_drcs_code->p_drcs_font_data[j];
-                free( p_drcs_font_data->p_drcs_pattern_data );
-                free( p_drcs_font_data->p_drcs_geometric_data );
-            }
-            free( p_drcs_code->p_drcs_font_data );
-        }
-        free( p_sys->p_drcs_data->p_drcs_code );
-        free( p_sys->p_drcs_data );
-    }
-    p_sys->p_drcs_data = (drcs_data_t*) malloc( sizeof(drcs_data_t) );
+    p_sys->p_drcs_data = (drcs_data_t*) ArenaCalloc( &p_sys->arena,
+            1, sizeof(drcs_data_t) );
     if( p_sys->p_drcs_data == NULL )
     {
-        return;
+        return false;
     }
 #endif //ARIBSUB_GEN_DRCS_DATA
 
-    int8_t i_NumberOfCode = bs_read( &p_sys->bs, 8 );
-    p_sys->i_data_unit_size += 1;
+    uint8_t i_NumberOfCode = bs64_read_u8( &p_sys->bs );
 
 #ifdef ARIBSUB_GEN_DRCS_DATA
-    p_sys->p_drcs_data->i_NumberOfCode = i_NumberOfCode;
-    p_sys->p_drcs_data->p_drcs_code = (drcs_code_t*) malloc(
-            (sizeof(drcs_code_t) * i_NumberOfCode ) );
+    p_sys->p_drcs_data->p_drcs_code = (drcs_code_t*) ArenaCalloc(
+            &p_sys->arena, i_NumberOfCode, sizeof(drcs_code_t) );
     if( p_sys->p_drcs_data->p_drcs_code == NULL )
     {
-        return;
+        return false;
     }
+    p_sys->p_drcs_data->i_NumberOfCode = i_NumberOfCode;
 #endif //ARIBSUB_GEN_DRCS_DATA
 
     for( int i = 0; i < i_NumberOfCode; i++ )
     {
-        uint16_t i_CharacterCode = bs_read( &p_sys->bs, 16 );
-        p_sys->i_data_unit_size += 2;
-        uint8_t i_NumberOfFont = bs_read( &p_sys->bs, 8 );
-        p_sys->i_data_unit_size += 1;
+        uint16_t i_CharacterCode = bs64_read_u16( &p_sys->bs );
+        uint8_t i_NumberOfFont = bs64_read_u8( &p_sys->bs );
+        int i_set = 0;
+        int i_code = drcs_code_index( i_data_unit_parameter,
+                i_CharacterCode, &i_set );
 
 #ifdef ARIBSUB_GEN_DRCS_DATA
         drcs_code_t *p_drcs_code = &p_sys->p_drcs_data->p_drcs_code[i];
         p_drcs_code->i_CharacterCode = i_CharacterCode;
-        p_drcs_code->i_NumberOfFont = i_NumberOfFont;
-        p_drcs_code->p_drcs_font_data = (drcs_font_data_t*) malloc(
-                (sizeof(drcs_font_data_t) * i_NumberOfFont ) );
+        p_drcs_code->p_drcs_font_data = (drcs_font_data_t*) ArenaCalloc(
+                &p_sys->arena, i_NumberOfFont, sizeof(drcs_font_data_t) );
         if( p_drcs_code->p_drcs_font_data == NULL )
         {
-            return;
+            return false;
         }
-#else
-        VLC_UNUSED(i_CharacterCode);
+        p_drcs_code->i_NumberOfFont = i_NumberOfFont;
 #endif //ARIBSUB_GEN_DRCS_DATA
 
         for( int j = 0; j < i_NumberOfFont; j++ )
         {
-            uint8_t i_fontId = bs_read( &p_sys->bs, 4 );
-            uint8_t i_mode = bs_read( &p_sys->bs, 4 );
-            p_sys->i_data_unit_size += 1;
+            uint8_t i_fontId = bs64_read( &p_sys->bs, 4 );
+            uint8_t i_mode = bs64_read( &p_sys->bs, 4 );
+            if( --p_sys->i_work_budget < 0 )
+                return false;
 
 #ifdef ARIBSUB_GEN_DRCS_DATA
             drcs_font_data_t* p_drcs_font_data =
@@ -760,110 +1737,98 @@ static void parse_data_unit_DRCS( decoder_t *p_dec,
 
             if( i_mode == 0x00 || i_mode == 0x01 )
             {
-                uint8_t i_depth = bs_read( &p_sys->bs, 8 );
-                p_sys->i_data_unit_size += 1;
-                uint8_t i_width = bs_read( &p_sys->bs, 8 );
-                p_sys->i_data_unit_size += 1;
-                uint8_t i_height = bs_read( &p_sys->bs, 8 );
-                p_sys->i_data_unit_size += 1;
+                uint8_t i_depth = bs64_read_u8( &p_sys->bs );
+                uint8_t i_width = bs64_read_u8( &p_sys->bs );
+                uint8_t i_height = bs64_read_u8( &p_sys->bs );
 
                 int i_bits_per_pixel = ceil( sqrt( ( i_depth + 2 ) ) );
+                int i_pattern_size = i_width * i_height * i_bits_per_pixel / 8;
+                if( (size_t)i_pattern_size > bs64_remain( &p_sys->bs ) / 8 )
+                    return false;
 
 #ifdef ARIBSUB_GEN_DRCS_DATA
                 drcs_pattern_data_t* p_drcs_pattern_data =
                     p_drcs_font_data->p_drcs_pattern_data =
-                    (drcs_pattern_data_t*) malloc(
-                            sizeof(drcs_pattern_data_t) );
+                    (drcs_pattern_data_t*) ArenaCalloc( &p_sys->arena,
+                            1, sizeof(drcs_pattern_data_t) );
                 if( p_drcs_pattern_data == NULL )
                 {
-                    return;
+                    return false;
                 }
                 p_drcs_pattern_data->i_depth = i_depth;
                 p_drcs_pattern_data->i_width = i_width;
                 p_drcs_pattern_data->i_height = i_height;
-                p_drcs_pattern_data->p_patternData =
-                    (int8_t*) malloc( sizeof(int8_t) *
-                            i_width * i_height * i_bits_per_pixel / 8 );
+                p_drcs_pattern_data->p_patternData = (int8_t*)
+                    ArenaAlloc( &p_sys->arena, sizeof(int8_t) * i_pattern_size );
                 if( p_drcs_pattern_data->p_patternData == NULL )
                 {
-                    return;
+                    return false;
                 }
 #else
-                int8_t *p_patternData =
-                    (int8_t*) malloc( sizeof(int8_t) *
-                            i_width * i_height * i_bits_per_pixel / 8 );
+                int8_t *p_patternData = (int8_t*)
+                    ArenaAlloc( &p_sys->arena, sizeof(int8_t) * i_pattern_size );
                 if( p_patternData == NULL )
                 {
-                    return;
+                    return false;
                 }
 #endif //ARIBSUB_GEN_DRCS_DATA
 
-                for( int k = 0; k < i_width * i_height * i_bits_per_pixel / 8; k++ )
-                {
-                    uint8_t i_patternData = bs_read( &p_sys->bs, 8 );
-                    p_sys->i_data_unit_size += 1;
 #ifdef ARIBSUB_GEN_DRCS_DATA
-                    p_drcs_pattern_data->p_patternData[k] = i_patternData;
+                bs64_read_bytes( &p_sys->bs, p_drcs_pattern_data->p_patternData,
+                        i_pattern_size );
 #else
-                    p_patternData[k] = i_patternData;
+                bs64_read_bytes( &p_sys->bs, p_patternData, i_pattern_size );
 #endif //ARIBSUB_GEN_DRCS_DATA
-                }
 
 #ifdef ARIBSUB_GEN_DRCS_DATA
-                save_drcs_pattern( p_dec, i_width, i_height, i_depth + 2,
-                        p_drcs_pattern_data->p_patternData, p_drcs_code->i_CharacterCode );
+                define_drcs_pattern( p_dec, i_width, i_height, i_depth + 2,
+                        p_drcs_pattern_data->p_patternData, i_set, i_code );
 #else
-                save_drcs_pattern( p_dec, i_width, i_height, i_depth + 2,
-                        p_patternData, p_drcs_code->i_CharacterCode );
-                free( p_patternData );
+                define_drcs_pattern( p_dec, i_width, i_height, i_depth + 2,
+                        p_patternData, i_set, i_code );
 #endif //ARIBSUB_GEN_DRCS_DATA
             }
             else
             {
-                uint8_t i_regionX = bs_read( &p_sys->bs, 8 );
-                p_sys->i_data_unit_size += 1;
-                uint8_t i_regionY = bs_read( &p_sys->bs, 8 );
-                p_sys->i_data_unit_size += 1;
-                uint16_t i_geometricData_length = bs_read( &p_sys->bs, 16 );
-                p_sys->i_data_unit_size += 2;
+                uint8_t i_regionX = bs64_read_u8( &p_sys->bs );
+                uint8_t i_regionY = bs64_read_u8( &p_sys->bs );
+                uint16_t i_geometricData_length = bs64_read_u16( &p_sys->bs );
+                if( i_geometricData_length > bs64_remain( &p_sys->bs ) / 8 )
+                    return false;
 
 #ifdef ARIBSUB_GEN_DRCS_DATA
                 drcs_geometric_data_t* p_drcs_geometric_data =
                     p_drcs_font_data->p_drcs_geometric_data =
-                    (drcs_geometric_data_t*) malloc(
-                            sizeof(drcs_geometric_data_t) );
+                    (drcs_geometric_data_t*) ArenaCalloc( &p_sys->arena,
+                            1, sizeof(drcs_geometric_data_t) );
                 if( p_drcs_geometric_data == NULL )
                 {
-                    return;
+                    return false;
                 }
                 p_drcs_geometric_data->i_regionX = i_regionX;
                 p_drcs_geometric_data->i_regionY = i_regionY;
                 p_drcs_geometric_data->i_geometricData_length = i_geometricData_length;
                 p_drcs_geometric_data->p_geometricData = (int8_t*)
-                    malloc( sizeof(int8_t) * i_geometricData_length );
+                    ArenaAlloc( &p_sys->arena, sizeof(int8_t) * i_geometricData_length );
                 if( p_drcs_geometric_data->p_geometricData == NULL )
                 {
-                    return;
+                    return false;
                 }
 #else
                 VLC_UNUSED(i_regionX);
                 VLC_UNUSED(i_regionY);
 #endif //ARIBSUB_GEN_DRCS_DATA
 
-                for( int k = 0; k < i_geometricData_length ; k++ )
-                {
-                    uint8_t i_geometricData = bs_read( &p_sys->bs, 8 );
-                    p_sys->i_data_unit_size += 1;
-
 #ifdef ARIBSUB_GEN_DRCS_DATA
-                    p_drcs_geometric_data->p_geometricData[k] = i_geometricData;
+                bs64_read_bytes( &p_sys->bs, p_drcs_geometric_data->p_geometricData,
+                        i_geometricData_length );
 #else
-                    VLC_UNUSED(i_geometricData);
+                bs64_skip_bytes( &p_sys->bs, i_geometricData_length );
 #endif //ARIBSUB_GEN_DRCS_DATA
-                }
             }
         }
     }
+    return true;
 }
 
 static void parse_data_unit_others( decoder_t *p_dec,
@@ -873,11 +1838,7 @@ static void parse_data_unit_others( decoder_t *p_dec,
     VLC_UNUSED(i_data_unit_parameter);
     decoder_sys_t *p_sys = p_dec->p_sys;
 
-    for( uint32_t i = 0; i < i_data_unit_size; i++ )
-    {
-        bs_skip( &p_sys->bs, 8 );
-        p_sys->i_data_unit_size += 1;
-    }
+    bs64_skip_bytes( &p_sys->bs, i_data_unit_size );
 }
 
 /*****************************************************************************
@@ -885,21 +1846,28 @@ static void parse_data_unit_others( decoder_t *p_dec,
  *****************************************************************************
  * ARIB STD-B24 VOLUME 1 Part 3 Chapter 9.4 Structure of data unit
  *****************************************************************************/
-static void parse_data_unit( decoder_t *p_dec )
+static bool parse_data_unit( decoder_t *p_dec )
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
 
-    uint8_t i_unit_separator = bs_read( &p_sys->bs, 8 );
-    p_sys->i_data_unit_size += 1;
+    uint8_t i_unit_separator = bs64_read_u8( &p_sys->bs );
     if( i_unit_separator != 0x1F )
     {
         //msg_Err( p_dec, "i_unit_separator != 0x1F: [%x]", i_unit_separator );
-        return;
+        return false;
+    }
+    if( --p_sys->i_work_budget < 0 )
+    {
+        return false;
+    }
+    uint8_t i_data_unit_parameter = bs64_read_u8( &p_sys->bs );
+    uint32_t i_data_unit_size = bs64_read_u24( &p_sys->bs );
+    if( i_data_unit_size > bs64_remain( &p_sys->bs ) / 8 )
+    {
+        i_data_unit_size = bs64_remain( &p_sys->bs ) / 8;
     }
-    uint8_t i_data_unit_parameter = bs_read( &p_sys->bs, 8 );
-    p_sys->i_data_unit_size += 1;
-    uint32_t i_data_unit_size = bs_read( &p_sys->bs, 24 );
-    p_sys->i_data_unit_size += 3;
+    size_t i_end = bs64_pos( &p_sys->bs ) + 8 * (size_t)i_data_unit_size;
+    bool b_ok = true;
     if( i_data_unit_parameter == 0x20 )
     {
         parse_data_unit_staement_body( p_dec,
@@ -909,7 +1877,7 @@ static void parse_data_unit( decoder_t *p_dec )
     else if( i_data_unit_parameter == 0x30 ||
             i_data_unit_parameter == 0x31 )
     {
-        parse_data_unit_DRCS( p_dec,
+        b_ok = parse_data_unit_DRCS( p_dec,
                 i_data_unit_parameter,
                 i_data_unit_size );
     }
@@ -919,6 +1887,16 @@ static void parse_data_unit( decoder_t *p_dec )
                 i_data_unit_parameter,
                 i_data_unit_size );
     }
+    p_sys->i_data_unit_size += 5 + i_data_unit_size;
+
+    /* a unit must never read past its own size; resync on its end */
+    size_t i_pos = bs64_pos( &p_sys->bs );
+    if( !b_ok || i_pos > i_end )
+    {
+        return false;
+    }
+    bs64_skip( &p_sys->bs, i_end - i_pos );
+    return true;
 }
 
 /*****************************************************************************
@@ -926,56 +1904,66 @@ static void parse_data_unit( decoder_t *p_dec )
  *****************************************************************************
  * ARIB STD-B24 VOLUME 1 Part 3 Chapter 9.3.1 Caption management data
  *****************************************************************************/
-static void parse_caption_management_data( decoder_t *p_dec )
+static bool parse_caption_management_data( decoder_t *p_dec )
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
 
-    uint8_t i_TMD = bs_read( &p_sys->bs, 2 );
-    bs_skip( &p_sys->bs, 6 ); /* Reserved */
+    uint8_t i_TMD = bs64_read( &p_sys->bs, 2 );
+    bs64_skip( &p_sys->bs, 6 ); /* Reserved */
     if( i_TMD == 0x02 /* 10 */ )
     {
-        uint64_t i_OTM = ((uint64_t)bs_read( &p_sys->bs, 32 ) << 4) & bs_read( &p_sys->bs, 4 );
+        uint64_t i_OTM = ((uint64_t)bs64_read_u32( &p_sys->bs ) << 4) & bs64_read( &p_sys->bs, 4 );
         VLC_UNUSED(i_OTM);
-        bs_skip( &p_sys->bs, 4 ); /* Reserved */
+        bs64_skip( &p_sys->bs, 4 ); /* Reserved */
     }
-    uint8_t i_num_languages = bs_read( &p_sys->bs, 8 );
+    uint8_t i_num_languages = bs64_read_u8( &p_sys->bs );
     for( int i = 0; i < i_num_languages; i++ )
     {
-        uint8_t i_language_tag = bs_read( &p_sys->bs, 3 );
+        uint8_t i_language_tag = bs64_read( &p_sys->bs, 3 );
         VLC_UNUSED(i_language_tag);
-        bs_skip( &p_sys->bs, 1 ); /* Reserved */
-        uint8_t i_DMF = bs_read( &p_sys->bs, 4 );
+        bs64_skip( &p_sys->bs, 1 ); /* Reserved */
+        uint8_t i_DMF = bs64_read( &p_sys->bs, 4 );
         if( i_DMF == 0x0C /* 1100 */ ||
                 i_DMF == 0x0D /* 1101 */ ||
                 i_DMF == 0x0E /* 1110 */ )
         {
-            uint8_t i_DC = bs_read( &p_sys->bs, 8 );
+            uint8_t i_DC = bs64_read_u8( &p_sys->bs );
             VLC_UNUSED(i_DC);
         }
-        uint32_t i_ISO_639_language_code = bs_read( &p_sys->bs, 24 );
+        uint32_t i_ISO_639_language_code = bs64_read_u24( &p_sys->bs );
         VLC_UNUSED(i_ISO_639_language_code);
-        uint8_t i_Format = bs_read( &p_sys->bs, 4 );
+        uint8_t i_Format = bs64_read( &p_sys->bs, 4 );
         VLC_UNUSED(i_Format);
-        uint8_t i_TCS = bs_read( &p_sys->bs, 2 );
+        uint8_t i_TCS = bs64_read( &p_sys->bs, 2 );
         VLC_UNUSED(i_TCS);
-        uint8_t i_rollup_mode = bs_read( &p_sys->bs, 2 );
+        uint8_t i_rollup_mode = bs64_read( &p_sys->bs, 2 );
         VLC_UNUSED(i_rollup_mode);
     }
-    uint32_t i_data_unit_loop_length = bs_read( &p_sys->bs, 24 );
-    free( p_sys->psz_subtitle_data );
+    uint32_t i_data_unit_loop_length = bs64_read_u24( &p_sys->bs );
+    if( i_data_unit_loop_length > bs64_remain( &p_sys->bs ) / 8 )
+    {
+        i_data_unit_loop_length = bs64_remain( &p_sys->bs ) / 8;
+    }
     p_sys->i_data_unit_size = 0;
     p_sys->i_subtitle_data_size = 0;
+    p_sys->i_subtitle_data_max = 0;
     p_sys->psz_subtitle_data = NULL;
     if( i_data_unit_loop_length > 0 )
     {
         p_sys->psz_subtitle_data = (unsigned char*)
-            malloc( sizeof(unsigned char) *
+            ArenaAlloc( &p_sys->arena, sizeof(unsigned char) *
                     (i_data_unit_loop_length + 1) );
+        if( p_sys->psz_subtitle_data )
+            p_sys->i_subtitle_data_max = i_data_unit_loop_length;
     }
     while( p_sys->i_data_unit_size < i_data_unit_loop_length )
     {
-        parse_data_unit( p_dec );
+        if( !parse_data_unit( p_dec ) )
+        {
+            return false;
+        }
     }
+    return true;
 }
 
 /*****************************************************************************
@@ -983,33 +1971,83 @@ static void parse_caption_management_data( decoder_t *p_dec )
  *****************************************************************************
  * ARIB STD-B24 VOLUME 1 Part 3 Chapter 9.3.2 Caption statement data
  *****************************************************************************/
-static void parse_caption_statement_data( decoder_t *p_dec )
+static bool parse_caption_statement_data( decoder_t *p_dec )
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
 
-    uint8_t i_TMD = bs_read( &p_sys->bs, 2 );
-    bs_skip( &p_sys->bs, 6 ); /* Reserved */
+    uint8_t i_TMD = bs64_read( &p_sys->bs, 2 );
+    bs64_skip( &p_sys->bs, 6 ); /* Reserved */
     if( i_TMD == 0x01 /* 01 */ || i_TMD == 0x02 /* 10 */ )
     {
-        uint64_t i_STM = ((uint64_t) bs_read( &p_sys->bs, 32 ) << 4) &
-            bs_read( &p_sys->bs, 4 );
+        uint64_t i_STM = ((uint64_t) bs64_read_u32( &p_sys->bs ) << 4) &
+            bs64_read( &p_sys->bs, 4 );
         VLC_UNUSED(i_STM);
-        bs_skip( &p_sys->bs, 4 ); /* Reserved */
+        bs64_skip( &p_sys->bs, 4 ); /* Reserved */
+    }
+    uint32_t i_data_unit_loop_length = bs64_read_u24( &p_sys->bs );
+    if( i_data_unit_loop_length > bs64_remain( &p_sys->bs ) / 8 )
+    {
+        i_data_unit_loop_length = bs64_remain( &p_sys->bs ) / 8;
     }
-    uint32_t i_data_unit_loop_length = bs_read( &p_sys->bs, 24 );
-    free( p_sys->psz_subtitle_data );
+    p_sys->i_data_unit_size = 0;
     p_sys->i_subtitle_data_size = 0;
+    p_sys->i_subtitle_data_max = 0;
     p_sys->psz_subtitle_data = NULL;
     if( i_data_unit_loop_length > 0 )
     {
-        p_sys->psz_subtitle_data =
-            (unsigned char*)malloc( sizeof(unsigned char) *
+        p_sys->psz_subtitle_data = (unsigned char*)
+            ArenaAlloc( &p_sys->arena, sizeof(unsigned char) *
                     (i_data_unit_loop_length + 1) );
+        if( p_sys->psz_subtitle_data )
+            p_sys->i_subtitle_data_max = i_data_unit_loop_length;
     }
     while( p_sys->i_data_unit_size < i_data_unit_loop_length )
     {
-        parse_data_unit( p_dec );
+        if( !parse_data_unit( p_dec ) )
+        {
+            return false;
+        }
     }
+    return true;
+}
+
+/*****************************************************************************
+ * is_retransmission
+ *****************************************************************************
+ * True when the data group is byte identical to the previous one of its
+ * kind (and has the same PTS if b_same_pts), otherwise remembers it.
+ *****************************************************************************/
+static bool is_retransmission( data_group_cache_t *p_cache,
+        const uint8_t *p_group, size_t i_group, mtime_t i_pts, bool b_same_pts )
+{
+    uint64_t i_hash = 0xcbf29ce484222325ULL; /* FNV-1a */
+
+    for( size_t i = 0; i < i_group; i++ )
+        i_hash = ( i_hash ^ p_group[i] ) * 0x100000001b3ULL;
+
+    if( p_cache->p_data && p_cache->i_hash == i_hash &&
+        p_cache->i_data == i_group && ( !b_same_pts || p_cache->i_pts == i_pts ) &&
+        memcmp( p_cache->p_data, p_group, i_group ) == 0 )
+        return true;
+
+    if( p_cache->i_alloc < i_group )
+    {
+        uint8_t *p_data = realloc( p_cache->p_data, i_group );
+        if( p_data == NULL )
+        {
+            free( p_cache->p_data );
+            p_cache->p_data = NULL;
+            p_cache->i_alloc = 0;
+            return false;
+        }
+        p_cache->p_data = p_data;
+        p_cache->i_alloc = i_group;
+    }
+    memcpy( p_cache->p_data, p_group, i_group );
+    p_cache->i_data = i_group;
+    p_cache->i_hash = i_hash;
+    p_cache->i_pts = i_pts;
+    return false;
 }
 
 /*****************************************************************************
@@ -1017,28 +2055,55 @@ static void parse_caption_statement_data( decoder_t *p_dec )
  *****************************************************************************
  * ARIB STD-B24 VOLUME 1 Part 3 Chapter 9.2 Structure of data group 
  *****************************************************************************/
-static void parse_data_group( decoder_t *p_dec )
+static bool parse_data_group( decoder_t *p_dec )
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
+    const uint8_t *p_group = p_sys->bs.p_start + bs64_pos( &p_sys->bs ) / 8;
 
-    uint8_t i_data_group_id = bs_read( &p_sys->bs, 6 );
-    uint8_t i_data_group_version = bs_read( &p_sys->bs, 2 );
+    uint8_t i_data_group_id = bs64_read( &p_sys->bs, 6 );
+    uint8_t i_data_group_version = bs64_read( &p_sys->bs, 2 );
     VLC_UNUSED(i_data_group_version);
-    uint8_t i_data_group_link_number = bs_read( &p_sys->bs, 8 );
+    uint8_t i_data_group_link_number = bs64_read_u8( &p_sys->bs );
     VLC_UNUSED(i_data_group_link_number);
-    uint8_t i_last_data_group_link_number = bs_read( &p_sys->bs, 8 );
+    uint8_t i_last_data_group_link_number = bs64_read_u8( &p_sys->bs );
     VLC_UNUSED(i_last_data_group_link_number);
-    uint16_t i_data_group_size = bs_read( &p_sys->bs, 16 );
-    VLC_UNUSED(i_data_group_size);
+    uint16_t i_data_group_size = bs64_read_u16( &p_sys->bs );
 
-    if( i_data_group_id == 0x00 || i_data_group_id == 0x20 )
+    /* 5 header bytes, data_group_data_byte and CRC_16 must all be there */
+    if( bs64_remain( &p_sys->bs ) / 8 < (size_t)i_data_group_size + 2 ||
+        Crc16( 0, p_group, 5 + i_data_group_size + 2 ) != 0 )
+    {
+        p_sys->i_crc_errors++;
+        if (p_sys->debugfp)
+            fprintf(p_sys->debugfp,"data group 0x%02x CRC error\n",i_data_group_id);
+        return false;
+    }
+
+    /* management data is resent every few seconds, statement data may be
+     * sent twice with the same PTS for robustness */
+    bool b_management = i_data_group_id == 0x00 || i_data_group_id == 0x20;
+    if( is_retransmission( b_management ? &p_sys->management_cache
+                                        : &p_sys->statement_cache,
+                p_group, 5 + i_data_group_size + 2,
+                p_sys->i_pts, !b_management ) )
     {
-        parse_caption_management_data( p_dec );
+        if (p_sys->debugfp)
+            fprintf(p_sys->debugfp,"data group 0x%02x repeated, skipped\n",i_data_group_id);
+        return false;
     }
-    else
+
+    /* the data unit loops are bounded by the data group, not the PES */
+    bs64_init( &p_sys->bs, p_group + 5, i_data_group_size );
+
+    bool b_ok = b_management ? parse_caption_management_data( p_dec )
+                             : parse_caption_statement_data( p_dec );
+    if( !b_ok )
     {
-        parse_caption_statement_data( p_dec );
+        p_sys->i_parse_errors++;
+        if (p_sys->debugfp)
+            fprintf(p_sys->debugfp,"data group 0x%02x malformed, dropped\n",i_data_group_id);
     }
+    return b_ok;
 }
 
 /*****************************************************************************
@@ -1046,30 +2111,30 @@ static void parse_data_group( decoder_t *p_dec )
  *****************************************************************************
  * ARIB STD-B24 VOLUME3 Chapter 5 Independent PES transmission protocol 
  *****************************************************************************/
-static void parse_arib_pes( decoder_t *p_dec )
+static bool parse_arib_pes( decoder_t *p_dec )
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
 
-    uint8_t i_data_group_id = bs_read( &p_sys->bs, 8 );
+    uint8_t i_data_group_id = bs64_read_u8( &p_sys->bs );
     if( i_data_group_id != 0x80 && i_data_group_id != 0x81 )
     {
         //msg_Err( p_dec, "parse_arib_pes: i_data_group_id is invalid.[%x]", i_data_group_id );
-        return;
+        return false;
     }
-    uint8_t i_private_stream_id = bs_read( &p_sys->bs, 8 );
+    uint8_t i_private_stream_id = bs64_read_u8( &p_sys->bs );
     if( i_private_stream_id != 0xFF )
     {
         //msg_Err( p_dec, "parse_arib_pes: i_private_stream_id is invalid.[%x]", i_private_stream_id );
-        return;
+        return false;
     }
-    uint8_t i_reserved_future_use = bs_read( &p_sys->bs, 4 );
+    uint8_t i_reserved_future_use = bs64_read( &p_sys->bs, 4 );
     VLC_UNUSED(i_reserved_future_use);
-    uint8_t i_PES_data_packet_header_length= bs_read( &p_sys->bs, 4 );
+    uint8_t i_PES_data_packet_header_length= bs64_read( &p_sys->bs, 4 );
 
     /* skip PES_data_private_data_byte */
-    bs_skip( &p_sys->bs, i_PES_data_packet_header_length );
+    bs64_skip_bytes( &p_sys->bs, i_PES_data_packet_header_length );
 
-    parse_data_group( p_dec );
+    return parse_data_group( p_dec );
 }
 
 static bool isallspace(char *buf,int len)
@@ -1084,10 +2149,10 @@ static void dumpheader(decoder_t *p_dec)
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
     char buf[1024];
-    if (p_sys->outputfile) {
-        p_sys->outputfp = vlc_fopen(p_sys->outputfile,"w");
+    if (p_sys->p_output->psz_file) {
+        p_sys->outputfp = vlc_fopen(p_sys->p_output->psz_file,"w");
         if (p_sys->outputfp == NULL) {
-            fprintf(stderr,"output [%s] can't open output to stdout\n",p_sys->outputfile);
+            fprintf(stderr,"output [%s] can't open output to stdout\n",p_sys->p_output->psz_file);
             p_sys->outputfp = stdout;
         }
     }
@@ -1101,6 +2166,7 @@ static void dumpheader(decoder_t *p_dec)
         }
         free(outputfile);
     }
+    p_sys->p_output->fp = p_sys->outputfp;
     FILE *fp = vlc_fopen( "assheader.ini", "r" );
     if (fp == NULL) {
         fprintf(p_sys->outputfp, "[Script Info]\n; Script generated by Aegisub v2.1.2 RELEASE PREVIEW (SVN r1987, amz)\n; http://www.aegisub.net\n;\n");
@@ -1125,18 +2191,19 @@ static void dumpheader(decoder_t *p_dec)
 static void dumpregion(decoder_t *p_dec,ass_region_buf_t *ass,mtime_t i_stop)
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
-    static bool dumpstart = true;
-    char *p2,*p3;
-    char *p_start,*p_stop,*pb_start,*pb_stop;
+    char p_start[DUMPTS_SIZE],p_stop[DUMPTS_SIZE];
+    char pb_start[DUMPTS_SIZE],pb_stop[DUMPTS_SIZE];
     mtime_t i,i_dur,i_int,i_off;
     i_int = 135000; // ブリンク間隔(1.5秒)
     i_dur = i_int / 2;  //表示時間
-    if (dumpstart) {
-        dumpheader(p_dec);
-        dumpstart=false;
-    }
-    p_start =dumpts(ass->i_start);
-    p_stop = dumpts(i_stop);
+    if (p_sys->outputfp == NULL) {
+        /* the first line of any caption PID creates the file */
+        if (p_sys->p_output->fp == NULL)
+            dumpheader(p_dec);
+        p_sys->outputfp = p_sys->p_output->fp;
+    }
+    dumpts(p_start,ass->i_start);
+    dumpts(p_stop,i_stop);
     for(ass_region_buf_t *p = ass;p;p = p->p_next) {
         if (p->f_blink > 0) {
             // f_blink = 2 の場合消灯からスタート
@@ -1144,68 +2211,44 @@ static void dumpregion(decoder_t *p_dec,ass_region_buf_t *ass,mtime_t i_stop)
             else i_off = i_dur;
             //表示を複数回に分けてBLINKするように見せかける
             for(i=ass->i_start;i<i_stop-i_off;i=i+i_int) {
-                pb_start = dumpts(i+i_off);
+                dumpts(pb_start,i+i_off);
                 if (i_stop < i+i_dur+i_off) {
-                    pb_stop = dumpts(i_stop);
+                    dumpts(pb_stop,i_stop);
                 }
                 else {
-                    pb_stop  = dumpts(i+i_dur+i_off);
+                    dumpts(pb_stop,i+i_dur+i_off);
                 }
-                asprintf(&p2,p->p_buf,pb_start,pb_stop);
-                fprintf(p_sys->outputfp, "%s",p2);
-                free(p2);
-                free(pb_start);
-                free(pb_stop);
+                fprintf(p_sys->outputfp, "Dialogue: 0,%s,%s,%s",pb_start,pb_stop,p->p_buf);
             }
         }
         else {
-            asprintf(&p2,p->p_buf,p_start,p_stop);
-            fprintf(p_sys->outputfp, "%s",p2);
-            free(p2);
+            fprintf(p_sys->outputfp, "Dialogue: 0,%s,%s,%s",p_start,p_stop,p->p_buf);
         }
-        free(p->p_buf);
-        //free(p);
     }
 }
-static void free_assregion( ass_region_buf_t *p_ass)
+static void flushregion(decoder_t *p_dec,mtime_t i_stop)
 {
-    ass_region_buf_t *asstmp;
-    asstmp = p_ass;
-    if (asstmp->p_next == NULL)
-    {
-        free(asstmp);
-    }
-    else
-    {
-        while(asstmp->p_next)
-        {
-            ass_region_buf_t *p;
-            p = asstmp;
-            asstmp = asstmp->p_next;
-            free(p);
-        }
-    }
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    dumpregion(p_dec,p_sys->p_ass,i_stop);
+    p_sys->p_ass = NULL;
+    ArenaReset(&p_sys->ass_arena);
 }
 static void pushregion(decoder_t  *p_dec,mtime_t i_start,mtime_t i_stop)
 {
-    arib_buf_region_t *p_region = p_dec->p_sys->arib_decoder.p_region;
-    static ass_region_buf_t *ass=NULL;
+    decoder_sys_t *p_sys = p_dec->p_sys;
+    arib_buf_region_t *p_region = p_sys->arib_decoder.p_region;
     ass_region_buf_t *asstmp;
-    char *p3,*p4,*style;
-    char tmp[512];
-    if (ass) {
-        dumpregion(p_dec,ass,i_start);
-        free_assregion(ass);
-        ass = NULL;
+    char *p3,*style;
+    if (p_sys->p_ass) {
+        flushregion(p_dec,i_start);
     }
     asstmp = NULL;
     for(arib_buf_region_t *p_buf_region = p_region;p_buf_region;p_buf_region = p_buf_region->p_next) {
         int i_size = p_buf_region->p_end - p_buf_region->p_start;
+        char *tmp = p_buf_region->p_start;
 
-        strncpy(tmp,p_buf_region->p_start,i_size);
-        tmp[i_size]=0;
         // skip space
-        if ((i_size == 0) || (i_size == 3 && strcmp(tmp,"　")==0) || isallspace(tmp,i_size))
+        if ((i_size == 0) || (i_size == 3 && strncmp(tmp,"　",3)==0) || isallspace(tmp,i_size))
         {
             continue;
         }
@@ -1222,45 +2265,40 @@ static void pushregion(decoder_t  *p_dec,mtime_t i_start,mtime_t i_stop)
 	{
 		style = "HLC";
 	}
+        /* start and end times are filled in by dumpregion */
         if (p_buf_region->i_foreground_color == 0xffffff) {
-            p4 = NULL;
-            asprintf(&p3,"Dialogue: 0,%%s,%%s,%s,,0000,0000,0000,,{\\pos(%d,%d)}%s\n",
+            p3 = ArenaPrintf(&p_sys->ass_arena,"%s,,0000,0000,0000,,{\\pos(%d,%d)}%.*s\n",
                     style,
                     p_buf_region->i_charleft - (p_buf_region->i_fontwidth + p_buf_region->i_horint) ,
                     p_buf_region->i_charbottom - (p_buf_region->i_fontheight + p_buf_region->i_verint),
-                    tmp);
+                    i_size,tmp);
         }
         else {
-            asprintf(&p3,"Dialogue: 0,%%s,%%s,%s,,0000,0000,0000,,{\\pos(%d,%d)\\c&H%06x&}%s\n",
+            p3 = ArenaPrintf(&p_sys->ass_arena,"%s,,0000,0000,0000,,{\\pos(%d,%d)\\c&H%06x&}%.*s\n",
                     style,
                     p_buf_region->i_charleft - (p_buf_region->i_fontwidth + p_buf_region->i_horint) ,
                     p_buf_region->i_charbottom - (p_buf_region->i_fontheight + p_buf_region->i_verint),
-                    p_buf_region->i_foreground_color,tmp);
+                    p_buf_region->i_foreground_color,i_size,tmp);
+        }
+        ass_region_buf_t *p_new = ArenaCalloc(&p_sys->ass_arena,1,sizeof(ass_region_buf_t));
+        if (p3 == NULL || p_new == NULL) {
+            continue;
         }
-        if (ass == NULL) {
-            asstmp = ass = calloc(1,sizeof(ass_region_buf_t));
+        if (asstmp == NULL) {
+            p_sys->p_ass = p_new;
         }
         else {
-            if (asstmp == NULL) {
-                ass_region_buf_t *p;
-                for(p = ass;p;p = p->p_next)
-                    asstmp = p;
-            }
-            asstmp->p_next = calloc(1,sizeof(ass_region_buf_t));
-            asstmp = asstmp->p_next;
+            asstmp->p_next = p_new;
         }
-        asstmp->p_buf = strdup(p3);
+        asstmp = p_new;
+        asstmp->p_buf = p3;
 #ifdef ADD_FLC_SUPPORT
         asstmp->f_blink = p_buf_region->i_blink;
 #endif
         asstmp->i_start = i_start;
-        free(p3);
-        //if (p4) free(p4);
     }
-    if (i_start != i_stop && ass) {
-        dumpregion(p_dec,ass,i_stop);
-        free_assregion(ass);
-        ass = NULL;
+    if (i_start != i_stop && p_sys->p_ass) {
+        flushregion(p_dec,i_stop);
     }
 }
 static void dumparib(decoder_t *p_dec,mtime_t i_pts)
@@ -1269,25 +2307,13 @@ static void dumparib(decoder_t *p_dec,mtime_t i_pts)
     int retlen;
     char *tostr;
     mtime_t i_stop;
-    static mtime_t i_prev_pts;
-    static arib_decoder_t *prev_decoder=NULL;
 
     if (p_sys->psz_subtitle_data == NULL) return;
 
-    tostr = malloc((p_sys->i_subtitle_data_size*3)+1);
+    tostr = ArenaAlloc(&p_sys->arena,(p_sys->i_subtitle_data_size*3)+1);
+    if (tostr == NULL) return;
     tostr[0]=0;
-    arib_initialize_decoder(&p_sys->arib_decoder,1);
-
-    p_sys->arib_decoder.i_drcs_num = p_sys->i_drcs_num;
-
-    for( int i = 0; i < p_sys->i_drcs_num; i++ )
-    {
-        strncpy( p_sys->arib_decoder.drcs_hash_table[i],
-                p_sys->drcs_hash_table[i], 32 );
-        p_sys->arib_decoder.drcs_hash_table[i][32] = '\0';
-        p_sys->arib_decoder.drcs_hash_code[i] = p_sys->drcs_hash_code[i];
-    }
-    p_sys->arib_decoder.p_drcs_conv = p_sys->p_drcs_conv;
+    arib_reset_decoder(&p_sys->arib_decoder,&p_sys->arib_decoder_pristine);
 
     retlen = arib_decode_buffer( &p_sys->arib_decoder,
             p_sys->psz_subtitle_data,
@@ -1301,19 +2327,18 @@ static void dumparib(decoder_t *p_dec,mtime_t i_pts)
     if (p_sys->arib_decoder.p_region && p_sys->debugfp) {
         const unsigned char* start = (const unsigned char*)p_sys->psz_subtitle_data;
         const unsigned char* end = (const unsigned char*)p_sys->psz_subtitle_data + p_sys->i_subtitle_data_size;
-        char *dumpdata,*pts,dumpwk[10];
-        dumpdata = calloc(1,(p_sys->i_subtitle_data_size * 4)+1);
-        while( start < end )
-        {
-            sprintf(dumpwk,"%02x ",*start++);
-            strcat(dumpdata,dumpwk);
+        char *dumpdata,*p_dump,pts[DUMPTS_SIZE];
+        p_dump = dumpdata = ArenaAlloc(&p_sys->arena,(p_sys->i_subtitle_data_size * 3)+1);
+        if (dumpdata) {
+            *p_dump = 0;
+            while( start < end )
+            {
+                p_dump += sprintf(p_dump,"%02x ",*start++);
+            }
         }
-        pts = dumpts(i_pts);
+        dumpts(pts,i_pts);
         fprintf(p_sys->debugfp,"pts[%s] control_time [%dms] str [%s]\n",pts,p_sys->arib_decoder.i_control_time*100,tostr);
-        fprintf(p_sys->debugfp,"dmp [%s]\n",dumpdata);
-
-        free(dumpdata);
-        free(pts);
+        fprintf(p_sys->debugfp,"dmp [%s]\n",dumpdata ? dumpdata : "");
     }
 
 #ifdef ADD_HLC_SUPPORT
@@ -1332,10 +2357,5 @@ static void dumparib(decoder_t *p_dec,mtime_t i_pts)
     }
 
     arib_finalize_decoder(&p_sys->arib_decoder);
-
-    p_sys->i_drcs_num = 0;
-
-    if (tostr) free(tostr);
-
 }
 
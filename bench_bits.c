@@ -0,0 +1,226 @@
+/*****************************************************************************
+ * bench_bits.c: bs_read against bs64_read
+ *****************************************************************************
+ * Parses the same corpus of synthetic caption PES, management and statement
+ * data groups whose data units hold text and DRCS patterns, with both bit
+ * readers and prints the throughput of each. The sums of the fields read
+ * must match, or the readers disagree.
+ *
+ *   bench_bits [megabytes] [rounds]
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "vlc_bits.h"
+
+#define PES_MAX     ( 4 * 1024 )
+
+/* bs_t under the names of the bs64_t calls the parser makes */
+static inline size_t bs_remain( const bs_t *s )
+{
+    return s->p < s->p_end ? 8 * ( s->p_end - s->p ) - 8 + s->i_left : 0;
+}
+
+static inline uint32_t bs_read_u8( bs_t *s )  { return bs_read( s, 8 ); }
+static inline uint32_t bs_read_u16( bs_t *s ) { return bs_read( s, 16 ); }
+static inline uint32_t bs_read_u24( bs_t *s ) { return bs_read( s, 24 ); }
+static inline uint32_t bs_read_u32( bs_t *s ) { return bs_read( s, 32 ); }
+
+static inline void bs_read_bytes( bs_t *s, void *p_dst, size_t i_count )
+{
+    uint8_t *p = p_dst;
+    for( size_t i = 0; i < i_count; i++ )
+        p[i] = bs_read( s, 8 );
+}
+
+static inline void bs_skip_bytes( bs_t *s, size_t i_count )
+{
+    bs_skip( s, 8 * i_count );
+}
+
+#define BENCH_BS( x )   bs_ ## x
+#define BENCH_BS_T      bs_t
+#include "bench_bits.h"
+#undef BENCH_BS
+#undef BENCH_BS_T
+
+#define BENCH_BS( x )   bs64_ ## x
+#define BENCH_BS_T      bs64_t
+#include "bench_bits.h"
+#undef BENCH_BS
+#undef BENCH_BS_T
+
+typedef struct
+{
+    uint8_t     *p_buf;
+    size_t      i_buf;
+    size_t      *pi_size;   /* of each PES, one after the other in p_buf */
+    unsigned int i_count;
+} corpus_t;
+
+static uint32_t i_seed = 1;
+
+static unsigned int rnd( unsigned int i_max )
+{
+    i_seed = i_seed * 1103515245 + 12345;
+    return ( i_seed >> 16 ) % i_max;
+}
+
+static int64_t now( void )
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint8_t *put( uint8_t *p, uint32_t i_value, int i_bytes )
+{
+    while( i_bytes-- > 0 )
+        *p++ = i_value >> ( 8 * i_bytes );
+    return p;
+}
+
+static uint8_t *put_unit( uint8_t *p, bool b_drcs )
+{
+    uint8_t *p_size;
+
+    *p++ = 0x1f;
+    *p++ = b_drcs ? 0x30 : 0x20;
+    p_size = p;
+    p += 3;
+    if( b_drcs )
+    {
+        int i_codes = 1 + rnd( 4 );
+        *p++ = i_codes;
+        for( int i = 0; i < i_codes; i++ )
+        {
+            int i_size = 16 + 2 * rnd( 11 );
+            p = put( p, 0x4121 + rnd( 94 ), 2 );
+            *p++ = 1;                       /* NumberOfFont */
+            *p++ = 0x00;                    /* fontId, mode */
+            *p++ = 2;                       /* depth, 2 bits per pixel */
+            *p++ = i_size;
+            *p++ = i_size;
+            for( int j = 0; j < i_size * i_size / 4; j++ )
+                *p++ = rnd( 256 );
+        }
+    }
+    else
+    {
+        int i_text = 10 + rnd( 60 );
+        for( int j = 0; j < i_text; j++ )
+            *p++ = rnd( 256 );
+    }
+    put( p_size, p - p_size - 3, 3 );
+    return p;
+}
+
+/* a PES data header and one data group, one management group in eight */
+static size_t put_pes( uint8_t *p_pes )
+{
+    bool b_management = rnd( 8 ) == 0;
+    uint8_t *p = p_pes, *p_group;
+
+    *p++ = 0x80;                            /* data_identifier */
+    *p++ = 0xff;                            /* private_stream_id */
+    *p++ = 0xf0;                            /* no PES_data_packet_header */
+
+    p_group = p;
+    *p++ = ( b_management ? 0x00 : 0x01 ) << 2;
+    *p++ = 0;
+    *p++ = 0;
+    p += 2;                                 /* data_group_size */
+    if( b_management )
+    {
+        *p++ = 0x3f;                        /* free TMD */
+        *p++ = 1;
+        *p++ = 0x0c;                        /* language_tag 0, DMF 1100 */
+        *p++ = 0x00;                        /* DC */
+        p = put( p, 0x6a706e, 3 );          /* "jpn" */
+        *p++ = 0x00;
+    }
+    else
+    {
+        *p++ = 0x3f;
+    }
+    uint8_t *p_loop = p;
+    p += 3;
+    int i_units = 1 + rnd( 3 );
+    for( int i = 0; i < i_units; i++ )
+        p = put_unit( p, !b_management && rnd( 4 ) == 0 );
+    put( p_loop, p - p_loop - 3, 3 );
+    put( p_group + 3, p - p_group - 5, 2 );
+    p = put( p, rnd( 0x10000 ), 2 );        /* CRC_16 */
+    return p - p_pes;
+}
+
+static int make_corpus( corpus_t *p_corpus, size_t i_bytes )
+{
+    unsigned int i_max = i_bytes / 64 + 1;
+
+    p_corpus->p_buf = malloc( i_bytes + PES_MAX );
+    p_corpus->pi_size = malloc( i_max * sizeof(*p_corpus->pi_size) );
+    if( !p_corpus->p_buf || !p_corpus->pi_size )
+        return -1;
+    p_corpus->i_buf = 0;
+    p_corpus->i_count = 0;
+    while( p_corpus->i_buf < i_bytes && p_corpus->i_count < i_max )
+    {
+        size_t i_size = put_pes( &p_corpus->p_buf[p_corpus->i_buf] );
+        p_corpus->pi_size[p_corpus->i_count++] = i_size;
+        p_corpus->i_buf += i_size;
+    }
+    return 0;
+}
+
+static double run( uint32_t (*pf_parse)( const uint8_t *, size_t, uint8_t * ),
+                   const corpus_t *p_corpus, int i_rounds, uint32_t *pi_sum )
+{
+    static uint8_t p_copy[0x10000];
+    int64_t i_start = now();
+
+    for( int r = 0; r < i_rounds; r++ )
+    {
+        const uint8_t *p = p_corpus->p_buf;
+        *pi_sum = 0;
+        for( unsigned int i = 0; i < p_corpus->i_count; i++ )
+        {
+            *pi_sum += pf_parse( p, p_corpus->pi_size[i], p_copy );
+            p += p_corpus->pi_size[i];
+        }
+    }
+    return (double)p_corpus->i_buf * i_rounds / ( now() - i_start ); /* MB/s */
+}
+
+int main( int i_argc, char *pa_argv[] )
+{
+    size_t i_bytes = ( i_argc > 1 ? atoi( pa_argv[1] ) : 16 ) * 1024 * 1024;
+    int i_rounds = i_argc > 2 ? atoi( pa_argv[2] ) : 8;
+    uint32_t i_sum, i_sum64;
+    corpus_t corpus;
+
+    if( i_rounds <= 0 || make_corpus( &corpus, i_bytes ) )
+        return EXIT_FAILURE;
+
+    double f_bs = run( bs_parse_pes, &corpus, i_rounds, &i_sum );
+    double f_bs64 = run( bs64_parse_pes, &corpus, i_rounds, &i_sum64 );
+    printf( "%u PES\n", corpus.i_count );
+    free( corpus.p_buf );
+    free( corpus.pi_size );
+
+    printf( "bs_read   %8.1f MB/s\n", f_bs );
+    printf( "bs64_read %8.1f MB/s (x%.2f)\n", f_bs64, f_bs64 / f_bs );
+    if( i_sum != i_sum64 )
+    {
+        fprintf( stderr, "mismatch: %08x != %08x\n", i_sum, i_sum64 );
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+/*****************************************************************************
+ * bench_bits.h: caption PES parsing, once per bit reader
+ *****************************************************************************
+ * Included by bench_bits.c for each reader, with BENCH_BS( x ) naming the
+ * function x of the reader and BENCH_BS_T its type. The PES data header,
+ * data groups and data units are read with the calls aribsub.c makes, a
+ * data group with a reader of its own; the fields read are summed.
+ *****************************************************************************/
+
+static uint32_t BENCH_BS( parse_units )( BENCH_BS_T *s, uint8_t *p_copy )
+{
+    uint32_t i_sum = 0;
+    size_t i_loop = BENCH_BS( read_u24 )( s );
+
+    if( i_loop > BENCH_BS( remain )( s ) / 8 )
+        i_loop = BENCH_BS( remain )( s ) / 8;
+    size_t i_loop_end = BENCH_BS( pos )( s ) + 8 * i_loop;
+
+    while( BENCH_BS( pos )( s ) + 5 * 8 <= i_loop_end )
+    {
+        if( BENCH_BS( read_u8 )( s ) != 0x1f )  /* unit_separator */
+            return i_sum;
+        uint32_t i_parameter = BENCH_BS( read_u8 )( s );
+        size_t i_size = BENCH_BS( read_u24 )( s );
+        if( i_size > BENCH_BS( remain )( s ) / 8 )
+            i_size = BENCH_BS( remain )( s ) / 8;
+        size_t i_end = BENCH_BS( pos )( s ) + 8 * i_size;
+        i_sum += i_parameter + i_size;
+
+        if( i_parameter == 0x20 && i_size > 0 )
+        {
+            BENCH_BS( read_bytes )( s, p_copy, i_size );
+            i_sum += p_copy[0] + p_copy[i_size - 1];
+        }
+        else if( i_parameter == 0x30 )
+        {
+            uint32_t i_codes = BENCH_BS( read_u8 )( s );
+            for( uint32_t i = 0; i < i_codes; i++ )
+            {
+                i_sum += BENCH_BS( read_u16 )( s );     /* CharacterCode */
+                uint32_t i_fonts = BENCH_BS( read_u8 )( s );
+                for( uint32_t j = 0; j < i_fonts; j++ )
+                {
+                    i_sum += BENCH_BS( read )( s, 4 );  /* fontId */
+                    i_sum += BENCH_BS( read )( s, 4 );  /* mode */
+                    uint32_t i_depth = BENCH_BS( read_u8 )( s );
+                    uint32_t i_width = BENCH_BS( read_u8 )( s );
+                    uint32_t i_height = BENCH_BS( read_u8 )( s );
+                    size_t i_pattern = i_width * i_height * 2 / 8;
+                    if( i_pattern > BENCH_BS( remain )( s ) / 8 )
+                        return i_sum;
+                    BENCH_BS( read_bytes )( s, p_copy, i_pattern );
+                    i_sum += i_depth + p_copy[0] + p_copy[i_pattern - 1];
+                }
+            }
+        }
+
+        size_t i_pos = BENCH_BS( pos )( s );
+        if( i_pos > i_end )
+            return i_sum;
+        BENCH_BS( skip )( s, i_end - i_pos );
+    }
+    return i_sum;
+}
+
+static uint32_t BENCH_BS( parse_group )( BENCH_BS_T *s, bool b_management,
+                                         uint8_t *p_copy )
+{
+    uint32_t i_sum = 0;
+    uint32_t i_TMD = BENCH_BS( read )( s, 2 );
+
+    BENCH_BS( skip )( s, 6 );
+    if( i_TMD == 0x02 )
+    {
+        i_sum += BENCH_BS( read_u32 )( s );     /* OTM */
+        i_sum += BENCH_BS( read )( s, 4 );
+        BENCH_BS( skip )( s, 4 );
+    }
+    if( b_management )
+    {
+        uint32_t i_languages = BENCH_BS( read_u8 )( s );
+        for( uint32_t i = 0; i < i_languages; i++ )
+        {
+            i_sum += BENCH_BS( read )( s, 3 );  /* language_tag */
+            BENCH_BS( skip )( s, 1 );
+            uint32_t i_DMF = BENCH_BS( read )( s, 4 );
+            if( i_DMF >= 0x0c && i_DMF <= 0x0e )
+                i_sum += BENCH_BS( read_u8 )( s );
+            i_sum += BENCH_BS( read_u24 )( s ); /* ISO_639_language_code */
+            i_sum += BENCH_BS( read )( s, 4 );
+            i_sum += BENCH_BS( read )( s, 2 );
+            i_sum += BENCH_BS( read )( s, 2 );
+        }
+    }
+    return i_sum + BENCH_BS( parse_units )( s, p_copy );
+}
+
+static uint32_t BENCH_BS( parse_pes )( const uint8_t *p_pes, size_t i_pes,
+                                       uint8_t *p_copy )
+{
+    BENCH_BS_T s;
+    uint32_t i_sum = 0;
+
+    BENCH_BS( init )( &s, p_pes, i_pes );
+    i_sum += BENCH_BS( read_u8 )( &s );         /* data_identifier */
+    i_sum += BENCH_BS( read_u8 )( &s );         /* private_stream_id */
+    BENCH_BS( skip )( &s, 4 );
+    BENCH_BS( skip_bytes )( &s, BENCH_BS( read )( &s, 4 ) );
+
+    while( BENCH_BS( remain )( &s ) >= 5 * 8 )
+    {
+        const uint8_t *p_group = p_pes + BENCH_BS( pos )( &s ) / 8;
+        uint32_t i_id = BENCH_BS( read )( &s, 6 );
+        i_sum += i_id + BENCH_BS( read )( &s, 2 );
+        i_sum += BENCH_BS( read_u8 )( &s );     /* link_number */
+        i_sum += BENCH_BS( read_u8 )( &s );     /* last_link_number */
+        size_t i_size = BENCH_BS( read_u16 )( &s );
+        if( BENCH_BS( remain )( &s ) / 8 < i_size + 2 )
+            break;
+
+        BENCH_BS_T group;
+        BENCH_BS( init )( &group, p_group + 5, i_size );
+        i_sum += BENCH_BS( parse_group )( &group, ( i_id & 0x1f ) == 0,
+                                          p_copy );
+        BENCH_BS( skip_bytes )( &s, i_size );
+        i_sum += BENCH_BS( read_u16 )( &s );    /* CRC_16 */
+    }
+    return i_sum;
+}
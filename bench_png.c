@@ -0,0 +1,117 @@
+/*****************************************************************************
+ * bench_png.c: DRCS pattern to PNG encoding rate
+ *****************************************************************************
+ * Encodes a synthetic glyph set, the sizes and 2-bit depth broadcasters
+ * use, as aribsub.c does for data/<md5>.png, and prints the glyphs encoded
+ * per second and the average image size. Nothing is written to disk.
+ *
+ *   bench_png [glyphs] [rounds]
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "drcspng.h"
+
+static const int pi_sizes[][2] = { { 16, 16 }, { 18, 18 }, { 20, 20 },
+                                   { 24, 24 }, { 30, 30 }, { 36, 36 } };
+#define SIZES   ( sizeof(pi_sizes) / sizeof(pi_sizes[0]) )
+
+typedef struct
+{
+    int     i_width;
+    int     i_height;
+    int8_t  *p_pattern;
+} glyph_t;
+
+static int64_t now( void )
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* a frame and a few strokes, so that zlib sees runs like a real glyph's */
+static int8_t *make_pattern( int i_width, int i_height, uint32_t *pi_seed )
+{
+    size_t i_pixels = (size_t)i_width * i_height;
+    uint8_t *p = calloc( 1, ( i_pixels + 3 ) / 4 );
+
+    if( p == NULL )
+        return NULL;
+    for( int y = 0; y < i_height; y++ )
+    {
+        *pi_seed = *pi_seed * 1103515245 + 12345;
+        int x0 = ( *pi_seed >> 16 ) % i_width;
+        int x1 = x0 + ( *pi_seed >> 8 ) % ( i_width - x0 );
+        for( int x = 0; x < i_width; x++ )
+        {
+            if( y == 1 || y == i_height - 2 || x == 1 || x == i_width - 2 ||
+                ( x >= x0 && x <= x1 && y % 3 == 0 ) )
+            {
+                size_t k = (size_t)y * i_width + x;
+                p[k / 4] |= 3 << ( 6 - 2 * ( k % 4 ) );
+            }
+        }
+    }
+    return (int8_t *)p;
+}
+
+int main( int i_argc, char *pa_argv[] )
+{
+    int i_glyphs = i_argc > 1 ? atoi( pa_argv[1] ) : 2000;
+    int i_rounds = i_argc > 2 ? atoi( pa_argv[2] ) : 5;
+    uint32_t i_seed = 1;
+    uint64_t i_bytes = 0;
+    glyph_t *p_glyphs;
+
+    if( i_glyphs <= 0 || i_rounds <= 0 )
+        return EXIT_FAILURE;
+    p_glyphs = calloc( i_glyphs, sizeof(*p_glyphs) );
+    if( p_glyphs == NULL )
+        return EXIT_FAILURE;
+    for( int i = 0; i < i_glyphs; i++ )
+    {
+        p_glyphs[i].i_width = pi_sizes[i % SIZES][0];
+        p_glyphs[i].i_height = pi_sizes[i % SIZES][1];
+        p_glyphs[i].p_pattern = make_pattern( p_glyphs[i].i_width,
+                                              p_glyphs[i].i_height, &i_seed );
+        if( p_glyphs[i].p_pattern == NULL )
+            return EXIT_FAILURE;
+    }
+
+    int64_t i_start = now();
+    for( int r = 0; r < i_rounds; r++ )
+    {
+        for( int i = 0; i < i_glyphs; i++ )
+        {
+            uint8_t *p_data;
+            size_t i_size;
+
+            if( DrcsPngEncode( &p_data, &i_size, p_glyphs[i].i_width,
+                               p_glyphs[i].i_height, 4, p_glyphs[i].p_pattern ) )
+            {
+                fprintf( stderr, "glyph %d not encoded\n", i );
+                return EXIT_FAILURE;
+            }
+            i_bytes += i_size;
+            free( p_data );
+        }
+    }
+    int64_t i_elapsed = now() - i_start;
+
+    printf( "%d glyphs x %d: %.0f glyphs/s, %.1f bytes per PNG\n",
+            i_glyphs, i_rounds,
+            i_elapsed > 0 ? 1e6 * i_glyphs * i_rounds / i_elapsed : 0.,
+            (double)i_bytes / ( (double)i_glyphs * i_rounds ) );
+
+    for( int i = 0; i < i_glyphs; i++ )
+        free( p_glyphs[i].p_pattern );
+    free( p_glyphs );
+    return EXIT_SUCCESS;
+}
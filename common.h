@@ -20,6 +20,8 @@
 #endif
 
 #define VLC_UNUSED(x) (void)(x)
+#define __MAX(a, b)   ( ((a) > (b)) ? (a) : (b) )
+#define __MIN(a, b)   ( ((a) < (b)) ? (a) : (b) )
 #define PRIx8	"x"
 #define	vlc_fopen	fopen
 #define	vlc_stat	stat
@@ -64,10 +66,11 @@ typedef struct {
     decoder_sys_t *p_sys;
 }decoder_t;
 
-static char * dumpts(mtime_t ts)
+/* buf must hold DUMPTS_SIZE bytes */
+#define DUMPTS_SIZE 32
+static inline char * dumpts(char *buf, mtime_t ts)
 {
     int sec,min,hour;
-    char *buf;
     sec = ts / 90000;
     ts -= (mtime_t)sec * (mtime_t)90000;
     min = sec / 60;
@@ -75,12 +78,26 @@ static char * dumpts(mtime_t ts)
     hour = min / 60;
     min -= hour * 60;
     //asprintf(&buf,"%02d:%02d:%02d.%02d", hour, min%60, sec%60, ts/900);
-    buf=malloc(512);
-    snprintf(buf,512,"%02d:%02d:%02d.%02d", hour, min%60, sec%60, ts/900);
+    snprintf(buf,DUMPTS_SIZE,"%02d:%02d:%02d.%02d", hour, min%60, sec%60, (int)(ts/900));
     return buf;
 }
 
-void *dec_open(void *,char *,char *,int);
+/* flags of dec_open */
+#define DEC_DEBUG       0x01    /* trace to <input>.asslog */
+#define DEC_DRCS_ATLAS  0x02    /* unknown DRCS in one <input>.drcs.png */
+#define DEC_DRCS_DRAWING 0x04   /* unknown DRCS as ASS drawings, no PNG */
+#define DEC_DRCS_SIMILAR 0x08   /* unknown DRCS take the code of a look-alike */
+
+/* the files shared by the decoders of all the caption PIDs */
+typedef struct dec_output_t
+{
+    char    *psz_file;  /* NULL for <input>.ass */
+    FILE    *fp;        /* opened by the first line written, closed by the caller */
+    struct drcs_atlas_s *p_atlas;   /* DEC_DRCS_ATLAS, saved by the last dec_close */
+} dec_output_t;
+
+void *dec_open(void *,char *,dec_output_t *,int);
 void *dec_close(void *);
+void dec_drcs_report(FILE *,int);
 
 #endif
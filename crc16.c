@@ -0,0 +1,61 @@
+/*****************************************************************************
+ * crc16.c: CRC-16/CCITT of ARIB STD-B24 data groups
+ *****************************************************************************
+ * Slicing-by-8: table k gives the CRC of a byte followed by k zero bytes,
+ * so eight input bytes are folded with eight lookups and no dependency
+ * between them.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "common.h"
+#include "crc16.h"
+
+static uint16_t crc16_table[8][256];
+static bool     b_crc16_table;
+
+static void Crc16Init( void )
+{
+    for( int i = 0; i < 256; i++ )
+    {
+        uint16_t i_crc = i << 8;
+        for( int j = 0; j < 8; j++ )
+            i_crc = ( i_crc & 0x8000 ) ? ( i_crc << 1 ) ^ 0x1021 : i_crc << 1;
+        crc16_table[0][i] = i_crc;
+    }
+    for( int k = 1; k < 8; k++ )
+    {
+        for( int i = 0; i < 256; i++ )
+        {
+            uint16_t i_prev = crc16_table[k - 1][i];
+            crc16_table[k][i] = ( i_prev << 8 ) ^ crc16_table[0][i_prev >> 8];
+        }
+    }
+    b_crc16_table = true;
+}
+
+uint16_t Crc16( uint16_t i_crc, const uint8_t *p_data, size_t i_data )
+{
+    if( !b_crc16_table )
+        Crc16Init();
+
+    while( i_data >= 8 )
+    {
+        i_crc ^= ( p_data[0] << 8 ) | p_data[1];
+        i_crc = crc16_table[7][i_crc >> 8] ^ crc16_table[6][i_crc & 0xff] ^
+                crc16_table[5][p_data[2]] ^ crc16_table[4][p_data[3]] ^
+                crc16_table[3][p_data[4]] ^ crc16_table[2][p_data[5]] ^
+                crc16_table[1][p_data[6]] ^ crc16_table[0][p_data[7]];
+        p_data += 8;
+        i_data -= 8;
+    }
+    while( i_data-- > 0 )
+        i_crc = ( i_crc << 8 ) ^ crc16_table[0][( i_crc >> 8 ) ^ *p_data++];
+
+    return i_crc;
+}
@@ -0,0 +1,14 @@
+/*****************************************************************************
+ * crc16.h: CRC-16/CCITT of ARIB STD-B24 data groups
+ *****************************************************************************/
+
+#ifndef CRC16_H
+# define CRC16_H
+
+/**
+ * Polynomial 0x1021, MSB first, no final xor. Start with i_crc = 0; running
+ * it over a data group including its trailing CRC_16 gives 0 when intact.
+ */
+uint16_t Crc16( uint16_t i_crc, const uint8_t *p_data, size_t i_data );
+
+#endif
@@ -0,0 +1,202 @@
+/*****************************************************************************
+ * drcs_conv_gen.c: compile drcs_conv.ini into drcs_conv_table.h
+ *****************************************************************************
+ * Run at build time. The keys of the ini are spread over buckets by the
+ * first half of their digest; buckets are then placed biggest first, each
+ * trying displacements until all of its keys land on free slots. The
+ * result is a table with exactly one slot per key, looked up with a single
+ * probe by DrcsConvGet().
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "drcsmap.h"
+
+#define MAX_DISPLACEMENT    (1 << 24)
+
+typedef struct
+{
+    uint8_t         digest[DRCS_DIGEST_SIZE];
+    unsigned int    i_code;
+    uint32_t        i_bucket;
+} conv_key_t;
+
+static conv_key_t *p_keys;
+static uint32_t i_keys;
+static uint32_t i_buckets;
+
+/* biggest buckets first, then by index so the output is reproducible */
+static const uint32_t *pi_bucket_size;
+static int CompareBuckets( const void *a, const void *b )
+{
+    uint32_t i_a = *(const uint32_t *)a, i_b = *(const uint32_t *)b;
+    if( pi_bucket_size[i_a] != pi_bucket_size[i_b] )
+        return pi_bucket_size[i_a] < pi_bucket_size[i_b] ? 1 : -1;
+    return i_a < i_b ? -1 : i_a > i_b;
+}
+
+static int ReadIni( const char *psz_file )
+{
+    FILE *fp = fopen( psz_file, "r" );
+    if( fp == NULL )
+    {
+        perror( psz_file );
+        return -1;
+    }
+
+    uint32_t i_alloc = 0;
+    char buf[256];
+    while( fgets( buf, sizeof(buf), fp ) != NULL )
+    {
+        uint8_t digest[DRCS_DIGEST_SIZE];
+        unsigned int i_code;
+        if( DrcsConvParseLine( buf, digest, &i_code ) )
+            continue;
+
+        /* the first line for a digest wins, as at run time */
+        uint32_t i;
+        for( i = 0; i < i_keys; i++ )
+            if( !memcmp( p_keys[i].digest, digest, DRCS_DIGEST_SIZE ) )
+                break;
+        if( i < i_keys )
+            continue;
+
+        if( i_keys == i_alloc )
+        {
+            i_alloc = i_alloc ? 2 * i_alloc : 256;
+            conv_key_t *p_new = realloc( p_keys, i_alloc * sizeof(*p_keys) );
+            if( p_new == NULL )
+            {
+                fclose( fp );
+                return -1;
+            }
+            p_keys = p_new;
+        }
+        memcpy( p_keys[i_keys].digest, digest, DRCS_DIGEST_SIZE );
+        p_keys[i_keys].i_code = i_code;
+        i_keys++;
+    }
+    fclose( fp );
+    return 0;
+}
+
+/* Fills pi_disp and pi_slot (key index per slot), -1 if no displacement fits */
+static int Build( uint32_t *pi_disp, uint32_t *pi_slot )
+{
+    uint32_t *pi_size = calloc( i_buckets, sizeof(*pi_size) );
+    uint32_t *pi_order = malloc( i_buckets * sizeof(*pi_order) );
+    uint32_t *pi_try = malloc( i_keys * sizeof(*pi_try) );
+    uint32_t *pi_members = malloc( i_keys * sizeof(*pi_members) );
+    int i_ret = -1;
+    if( !pi_size || !pi_order || !pi_try || !pi_members )
+        goto end;
+
+    for( uint32_t i = 0; i < i_keys; i++ )
+    {
+        p_keys[i].i_bucket = DrcsPhfBucket( p_keys[i].digest, i_buckets );
+        pi_size[p_keys[i].i_bucket]++;
+    }
+    for( uint32_t i = 0; i < i_buckets; i++ )
+        pi_order[i] = i;
+    pi_bucket_size = pi_size;
+    qsort( pi_order, i_buckets, sizeof(*pi_order), CompareBuckets );
+
+    for( uint32_t i = 0; i < i_keys; i++ )
+        pi_slot[i] = UINT32_MAX;
+
+    for( uint32_t b = 0; b < i_buckets && pi_size[pi_order[b]] > 0; b++ )
+    {
+        uint32_t i_bucket = pi_order[b];
+        uint32_t i_members = 0;
+        for( uint32_t i = 0; i < i_keys; i++ )
+            if( p_keys[i].i_bucket == i_bucket )
+                pi_members[i_members++] = i;
+
+        uint32_t d;
+        for( d = 0; d < MAX_DISPLACEMENT; d++ )
+        {
+            uint32_t j;
+            for( j = 0; j < i_members; j++ )
+            {
+                pi_try[j] = DrcsPhfSlot( p_keys[pi_members[j]].digest, d, i_keys );
+                if( pi_slot[pi_try[j]] != UINT32_MAX )
+                    break;
+                uint32_t k;
+                for( k = 0; k < j; k++ )
+                    if( pi_try[k] == pi_try[j] )
+                        break;
+                if( k < j )
+                    break;
+            }
+            if( j == i_members )
+                break;
+        }
+        if( d == MAX_DISPLACEMENT )
+            goto end;
+
+        pi_disp[i_bucket] = d;
+        for( uint32_t j = 0; j < i_members; j++ )
+            pi_slot[pi_try[j]] = pi_members[j];
+    }
+    i_ret = 0;
+
+end:
+    free( pi_size );
+    free( pi_order );
+    free( pi_try );
+    free( pi_members );
+    return i_ret;
+}
+
+int main( int argc, char **argv )
+{
+    if( argc != 2 )
+    {
+        fprintf( stderr, "usage: %s drcs_conv.ini > drcs_conv_table.h\n", argv[0] );
+        return 1;
+    }
+    if( ReadIni( argv[1] ) )
+        return 1;
+
+    /* about two keys per bucket keeps the displacement search short */
+    i_buckets = i_keys / 2 + 1;
+    uint32_t *pi_disp = calloc( i_buckets, sizeof(*pi_disp) );
+    uint32_t *pi_slot = malloc( ( i_keys ? i_keys : 1 ) * sizeof(*pi_slot) );
+    if( pi_disp == NULL || pi_slot == NULL || Build( pi_disp, pi_slot ) )
+    {
+        fprintf( stderr, "%s: cannot build the table\n", argv[0] );
+        return 1;
+    }
+
+    printf( "/* Generated by drcs_conv_gen from %s, do not edit. */\n\n", argv[1] );
+    printf( "#define DRCS_CONV_BUILTIN_COUNT     %u\n", i_keys );
+    printf( "#define DRCS_CONV_BUILTIN_BUCKETS   %u\n\n", i_buckets );
+
+    printf( "static const uint32_t drcs_conv_builtin_disp[%u] =\n{", i_buckets );
+    for( uint32_t i = 0; i < i_buckets; i++ )
+        printf( "%s%u,", i % 12 ? " " : "\n    ", pi_disp[i] );
+    printf( "\n};\n\n" );
+
+    /* an empty ini still needs one (unused) entry to be valid C */
+    printf( "static const drcs_map_entry_t drcs_conv_builtin[%u] =\n{\n",
+            i_keys ? i_keys : 1 );
+    for( uint32_t i = 0; i < i_keys; i++ )
+    {
+        const conv_key_t *p_key = &p_keys[pi_slot[i]];
+        printf( "    { {" );
+        for( int j = 0; j < DRCS_DIGEST_SIZE; j++ )
+            printf( "%s0x%02x", j ? "," : "", p_key->digest[j] );
+        printf( "}, 0x%x },\n", p_key->i_code );
+    }
+    if( i_keys == 0 )
+        printf( "    { {0}, 0 },\n" );
+    printf( "};\n" );
+
+    free( pi_disp );
+    free( pi_slot );
+    free( p_keys );
+    return ferror( stdout ) ? 1 : 0;
+}
@@ -0,0 +1,357 @@
+/*****************************************************************************
+ * drcscat.c: DRCS catalog kept across runs
+ *****************************************************************************
+ * drcs_catalog.idx and drcs_catalog.log share one layout (host byte order):
+ *   "ARIBCAT1"
+ *   records: drcs_catalog_record_t, then i_name bytes of file name
+ * Records are read in order and add up, so the index holds absolute counts
+ * and the log the counts of the runs since. A record cut short by a crash
+ * ends the file; the log is then compacted before the next append, which
+ * would otherwise follow the cut record and be lost with it.
+ *
+ * Each run appends its records with a single write(), so runs finishing
+ * together do not interleave them. Compaction moves the log aside before
+ * reading it, so runs appending meanwhile start a new one.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "drcsmap.h"
+#include "drcscat.h"
+
+#define DRCSCAT_MAGIC       "ARIBCAT1"
+#define DRCSCAT_INDEX       "drcs_catalog.idx"
+#define DRCSCAT_LOG         "drcs_catalog.log"
+
+typedef struct
+{
+    uint8_t         digest[DRCS_DIGEST_SIZE];
+    uint32_t        i_count;
+    uint8_t         i_width;
+    uint8_t         i_height;
+    uint8_t         i_depth;
+    uint8_t         i_flags;
+    uint32_t        i_name;
+} drcs_catalog_record_t;
+
+void DrcsCatalogInit( drcs_catalog_t *p_cat )
+{
+    DrcsMapInit( &p_cat->index );
+    p_cat->p_entries = NULL;
+    p_cat->i_entries = 0;
+    p_cat->i_max = 0;
+    p_cat->i_logged = 0;
+    p_cat->b_log_cut = false;
+}
+
+void DrcsCatalogClean( drcs_catalog_t *p_cat )
+{
+    for( unsigned int i = 0; i < p_cat->i_entries; i++ )
+        free( p_cat->p_entries[i].psz_first );
+    free( p_cat->p_entries );
+    DrcsMapClean( &p_cat->index );
+    DrcsCatalogInit( p_cat );
+}
+
+drcs_catalog_entry_t *DrcsCatalogGet( const drcs_catalog_t *p_cat,
+                                      const uint8_t *p_digest )
+{
+    unsigned int i_index = DrcsMapGet( &p_cat->index, p_digest );
+    return i_index ? &p_cat->p_entries[i_index - 1] : NULL;
+}
+
+static drcs_catalog_entry_t *DrcsCatalogAdd( drcs_catalog_t *p_cat,
+        const uint8_t *p_digest, int i_width, int i_height, int i_depth,
+        const char *psz_first )
+{
+    if( p_cat->i_entries == p_cat->i_max )
+    {
+        unsigned int i_max = p_cat->i_max ? 2 * p_cat->i_max : 64;
+        drcs_catalog_entry_t *p_new = realloc( p_cat->p_entries,
+                                               i_max * sizeof(*p_new) );
+        if( p_new == NULL )
+            return NULL;
+        p_cat->p_entries = p_new;
+        p_cat->i_max = i_max;
+    }
+    if( DrcsMapAdd( &p_cat->index, p_digest, p_cat->i_entries + 1 ) )
+        return NULL;
+
+    drcs_catalog_entry_t *p_entry = &p_cat->p_entries[p_cat->i_entries++];
+    memset( p_entry, 0, sizeof(*p_entry) );
+    memcpy( p_entry->digest, p_digest, DRCS_DIGEST_SIZE );
+    p_entry->i_width = i_width;
+    p_entry->i_height = i_height;
+    p_entry->i_depth = i_depth;
+    p_entry->psz_first = psz_first ? strdup( psz_first ) : NULL;
+    return p_entry;
+}
+
+drcs_catalog_entry_t *DrcsCatalogSeen( drcs_catalog_t *p_cat,
+        const uint8_t *p_digest, int i_width, int i_height, int i_depth,
+        const char *psz_file )
+{
+    drcs_catalog_entry_t *p_entry = DrcsCatalogGet( p_cat, p_digest );
+    if( p_entry == NULL )
+        p_entry = DrcsCatalogAdd( p_cat, p_digest,
+                                  i_width, i_height, i_depth, psz_file );
+    if( p_entry == NULL )
+        return NULL;
+    p_entry->i_count++;
+    p_entry->i_new++;
+    p_entry->b_dirty = true;
+    return p_entry;
+}
+
+void DrcsCatalogSetFlags( drcs_catalog_entry_t *p_entry, uint8_t i_flags )
+{
+    if( p_entry->i_flags != i_flags )
+    {
+        p_entry->i_flags = i_flags;
+        p_entry->b_dirty = true;
+    }
+}
+
+/*
+ * records read, -1 if the file is missing or not a catalog; *pb_cut tells
+ * whether the reading stopped on a record cut short or garbled
+ */
+static int DrcsCatalogRead( drcs_catalog_t *p_cat, const char *psz_file,
+                            bool *pb_cut )
+{
+    char psz_magic[8];
+    drcs_catalog_record_t rec;
+    int i_records = 0;
+    bool b_cut = false;
+
+    FILE *fp = vlc_fopen( psz_file, "rb" );
+    if( fp == NULL )
+        return -1;
+    if( fread( psz_magic, 8, 1, fp ) != 1 ||
+        memcmp( psz_magic, DRCSCAT_MAGIC, 8 ) )
+    {
+        fclose( fp );
+        return -1;
+    }
+
+    for( ;; )
+    {
+        char psz_name[1024];
+        size_t i_read = fread( &rec, 1, sizeof(rec), fp );
+        if( i_read == 0 && feof( fp ) )
+            break;
+        if( i_read != sizeof(rec) || rec.i_name >= sizeof(psz_name) ||
+            fread( psz_name, 1, rec.i_name, fp ) != rec.i_name )
+        {
+            b_cut = !ferror( fp );
+            break;
+        }
+        psz_name[rec.i_name] = '\0';
+
+        drcs_catalog_entry_t *p_entry = DrcsCatalogGet( p_cat, rec.digest );
+        if( p_entry == NULL )
+            p_entry = DrcsCatalogAdd( p_cat, rec.digest,
+                                      rec.i_width, rec.i_height, rec.i_depth,
+                                      rec.i_name ? psz_name : NULL );
+        if( p_entry == NULL )
+            break;
+        p_entry->i_count += rec.i_count;
+        p_entry->i_flags = rec.i_flags;     /* the latest run knows best */
+        i_records++;
+    }
+    fclose( fp );
+    if( pb_cut != NULL )
+        *pb_cut = b_cut;
+    return i_records;
+}
+
+static char *DrcsCatalogFile( const char *psz_dir, const char *psz_name )
+{
+    char *psz_file;
+    if( asprintf( &psz_file, "%s"DIR_SEP"%s", psz_dir, psz_name ) < 0 )
+        return NULL;
+    return psz_file;
+}
+
+int DrcsCatalogLoad( drcs_catalog_t *p_cat, const char *psz_dir )
+{
+    char *psz_index = DrcsCatalogFile( psz_dir, DRCSCAT_INDEX );
+    char *psz_log = DrcsCatalogFile( psz_dir, DRCSCAT_LOG );
+    int i_ret = -1;
+
+    if( psz_index != NULL && psz_log != NULL )
+    {
+        int i_index = DrcsCatalogRead( p_cat, psz_index, NULL );
+        int i_log = DrcsCatalogRead( p_cat, psz_log, &p_cat->b_log_cut );
+        if( i_log > 0 )
+            p_cat->i_logged = i_log;
+        if( i_index >= 0 || i_log >= 0 )
+            i_ret = 0;
+    }
+    free( psz_index );
+    free( psz_log );
+    return i_ret;
+}
+
+/* records of the entries, the dirty ones only unless b_all, into one buffer */
+static uint8_t *DrcsCatalogPack( const drcs_catalog_t *p_cat, bool b_all,
+                                 bool b_magic, size_t *pi_size, int *pi_records )
+{
+    size_t i_size = b_magic ? 8 : 0;
+    for( unsigned int i = 0; i < p_cat->i_entries; i++ )
+    {
+        const drcs_catalog_entry_t *p_entry = &p_cat->p_entries[i];
+        if( b_all || p_entry->b_dirty )
+            i_size += sizeof(drcs_catalog_record_t) +
+                      ( p_entry->psz_first ? strlen( p_entry->psz_first ) : 0 );
+    }
+
+    uint8_t *p_buf = malloc( i_size ? i_size : 1 );
+    if( p_buf == NULL )
+        return NULL;
+
+    uint8_t *p = p_buf;
+    if( b_magic )
+    {
+        memcpy( p, DRCSCAT_MAGIC, 8 );
+        p += 8;
+    }
+    *pi_records = 0;
+    for( unsigned int i = 0; i < p_cat->i_entries; i++ )
+    {
+        const drcs_catalog_entry_t *p_entry = &p_cat->p_entries[i];
+        if( !b_all && !p_entry->b_dirty )
+            continue;
+
+        drcs_catalog_record_t rec;
+        memset( &rec, 0, sizeof(rec) );
+        memcpy( rec.digest, p_entry->digest, DRCS_DIGEST_SIZE );
+        rec.i_count = b_all ? p_entry->i_count : p_entry->i_new;
+        rec.i_width = p_entry->i_width;
+        rec.i_height = p_entry->i_height;
+        rec.i_depth = p_entry->i_depth;
+        rec.i_flags = p_entry->i_flags;
+        rec.i_name = p_entry->psz_first ? strlen( p_entry->psz_first ) : 0;
+        memcpy( p, &rec, sizeof(rec) );
+        memcpy( p + sizeof(rec), p_entry->psz_first, rec.i_name );
+        p += sizeof(rec) + rec.i_name;
+        (*pi_records)++;
+    }
+    *pi_size = i_size;
+    return p_buf;
+}
+
+/* folds the log into the index, reading both afresh */
+static int DrcsCatalogCompact( const char *psz_dir )
+{
+    char *psz_index = DrcsCatalogFile( psz_dir, DRCSCAT_INDEX );
+    char *psz_log = DrcsCatalogFile( psz_dir, DRCSCAT_LOG );
+    char *psz_moved = NULL, *psz_tmp = NULL;
+    drcs_catalog_t cat;
+    uint8_t *p_buf = NULL;
+    size_t i_size;
+    int i_records;
+    int i_ret = -1;
+
+    DrcsCatalogInit( &cat );
+    if( psz_index == NULL || psz_log == NULL ||
+        asprintf( &psz_moved, "%s.%ld", psz_log, (long)getpid() ) < 0 ||
+        asprintf( &psz_tmp, "%s.%ld.tmp", psz_index, (long)getpid() ) < 0 )
+        goto end;
+    if( rename( psz_log, psz_moved ) != 0 )
+        goto end;
+
+    DrcsCatalogRead( &cat, psz_index, NULL );
+    DrcsCatalogRead( &cat, psz_moved, NULL );
+    p_buf = DrcsCatalogPack( &cat, true, true, &i_size, &i_records );
+
+    FILE *fp = p_buf ? vlc_fopen( psz_tmp, "wb" ) : NULL;
+    if( fp != NULL )
+    {
+        i_ret = fwrite( p_buf, 1, i_size, fp ) == i_size ? 0 : -1;
+        if( fclose( fp ) != 0 )
+            i_ret = -1;
+        if( i_ret == 0 && rename( psz_tmp, psz_index ) != 0 )
+            i_ret = -1;
+        if( i_ret != 0 )
+            unlink( psz_tmp );
+    }
+    /* not folded in, the moved log goes back to be appended to again */
+    if( i_ret == 0 )
+        unlink( psz_moved );
+    else
+        rename( psz_moved, psz_log );
+
+end:
+    DrcsCatalogClean( &cat );
+    free( p_buf );
+    free( psz_index );
+    free( psz_log );
+    free( psz_moved );
+    free( psz_tmp );
+    return i_ret;
+}
+
+int DrcsCatalogSave( drcs_catalog_t *p_cat, const char *psz_dir )
+{
+    bool b_dirty = false;
+    for( unsigned int i = 0; i < p_cat->i_entries && !b_dirty; i++ )
+        b_dirty = p_cat->p_entries[i].b_dirty;
+    if( !b_dirty )
+        return 0;
+
+    /* appended after a cut record, this run would be read as garbage */
+    if( p_cat->b_log_cut )
+    {
+        if( DrcsCatalogCompact( psz_dir ) != 0 )
+            return -1;
+        p_cat->b_log_cut = false;
+        p_cat->i_logged = 0;
+    }
+
+    char *psz_log = DrcsCatalogFile( psz_dir, DRCSCAT_LOG );
+    if( psz_log == NULL )
+        return -1;
+    FILE *fp = vlc_fopen( psz_log, "ab" );
+    free( psz_log );
+    if( fp == NULL )
+        return -1;
+
+    /* unbuffered, so the whole run goes out in one write() */
+    setvbuf( fp, NULL, _IONBF, 0 );
+    fseek( fp, 0, SEEK_END );
+
+    size_t i_size;
+    int i_records;
+    uint8_t *p_buf = DrcsCatalogPack( p_cat, false, ftell( fp ) == 0,
+                                      &i_size, &i_records );
+    int i_ret = -1;
+    if( p_buf != NULL && fwrite( p_buf, 1, i_size, fp ) == i_size )
+        i_ret = 0;
+    free( p_buf );
+    if( fclose( fp ) != 0 )
+        i_ret = -1;
+    if( i_ret != 0 )
+        return -1;
+
+    for( unsigned int i = 0; i < p_cat->i_entries; i++ )
+    {
+        p_cat->p_entries[i].b_dirty = false;
+        p_cat->p_entries[i].i_new = 0;
+    }
+    p_cat->i_logged += i_records;
+
+    /* the log is read on every start; keep it below the index */
+    if( p_cat->i_logged > p_cat->i_entries && DrcsCatalogCompact( psz_dir ) == 0 )
+        p_cat->i_logged = 0;
+    return 0;
+}
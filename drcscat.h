@@ -0,0 +1,52 @@
+/*****************************************************************************
+ * drcscat.h: DRCS catalog kept across runs
+ *****************************************************************************
+ * Every DRCS pattern ever shown, by digest: its geometry, the file it was
+ * first shown in, how many times it was shown after being (re)transmitted
+ * and whether it is mapped or has its PNG in the data dir. Each run appends
+ * what it changed to drcs_catalog.log; once the log outgrows the catalog it
+ * is folded into drcs_catalog.idx, which holds one record per pattern.
+ *****************************************************************************/
+
+#ifndef DRCSCAT_H
+# define DRCSCAT_H
+
+#define DRCS_CATALOG_MAPPED     0x01    /* in drcs_conv.ini when last seen */
+#define DRCS_CATALOG_PNG        0x02    /* data/<md5>.png was written */
+
+typedef struct drcs_catalog_entry_s
+{
+    uint8_t         digest[DRCS_DIGEST_SIZE];
+    uint32_t        i_count;        /* first uses, all runs */
+    uint32_t        i_new;          /* of which this run, not yet logged */
+    uint8_t         i_width;
+    uint8_t         i_height;
+    uint8_t         i_depth;
+    uint8_t         i_flags;        /* DRCS_CATALOG_* */
+    bool            b_dirty;        /* to be logged */
+    char            *psz_first;     /* file it was first shown in */
+} drcs_catalog_entry_t;
+
+typedef struct drcs_catalog_s
+{
+    drcs_map_t      index;          /* digest to entry + 1 */
+    drcs_catalog_entry_t *p_entries;
+    unsigned int    i_entries;
+    unsigned int    i_max;
+    unsigned int    i_logged;       /* records in the log */
+    bool            b_log_cut;      /* the log ends in a cut record */
+} drcs_catalog_t;
+
+void DrcsCatalogInit( drcs_catalog_t * );
+void DrcsCatalogClean( drcs_catalog_t * );
+/* reads the catalog of a data dir, -1 if it has none yet */
+int  DrcsCatalogLoad( drcs_catalog_t *, const char *psz_dir );
+/* appends the changes of this run to the log, compacting it when due */
+int  DrcsCatalogSave( drcs_catalog_t *, const char *psz_dir );
+drcs_catalog_entry_t *DrcsCatalogGet( const drcs_catalog_t *, const uint8_t * );
+/* counts one first use of a pattern, NULL when out of memory */
+drcs_catalog_entry_t *DrcsCatalogSeen( drcs_catalog_t *, const uint8_t *,
+                                       int, int, int, const char * );
+void DrcsCatalogSetFlags( drcs_catalog_entry_t *, uint8_t );
+
+#endif
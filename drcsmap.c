@@ -0,0 +1,262 @@
+/*****************************************************************************
+ * drcsmap.c: DRCS pattern digest to code point table
+ *****************************************************************************
+ * The table is kept at most half full and doubled when it would not be, so
+ * a probe sequence is short and always ends on an empty slot.
+ *
+ * Cache file layout (host byte order, rebuilt whenever it does not match):
+ *   "ARIBDRC1"
+ *   int64 ini size, int64 ini mtime
+ *   uint32 sizeof(drcs_map_entry_t), uint32 reserved
+ *   uint64 slot count, uint64 entry count
+ *   drcs_map_entry_t slots[slot count]
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#include "common.h"
+#include "drcsmap.h"
+#include "drcs_conv_table.h"
+
+#define DRCSMAP_MIN_SLOTS   64
+#define DRCSMAP_MAGIC       "ARIBDRC1"
+
+typedef struct
+{
+    char            psz_magic[8];
+    int64_t         i_size;
+    int64_t         i_mtime;
+    uint32_t        i_entry_size;
+    uint32_t        i_reserved;
+    uint64_t        i_slots;
+    uint64_t        i_count;
+} drcs_map_header_t;
+
+static size_t DrcsMapSlot( const drcs_map_t *p_map, const uint8_t *p_digest )
+{
+    uint64_t i_hash;
+    memcpy( &i_hash, p_digest, sizeof(i_hash) );
+    return (size_t)i_hash & p_map->i_mask;
+}
+
+void DrcsMapInit( drcs_map_t *p_map )
+{
+    p_map->p_slots = NULL;
+    p_map->i_mask = 0;
+    p_map->i_count = 0;
+    p_map->p_mapped = NULL;
+    p_map->i_mapped = 0;
+}
+
+void DrcsMapClean( drcs_map_t *p_map )
+{
+    if( p_map->p_mapped != NULL )
+    {
+#ifdef HAVE_SYS_MMAN_H
+        munmap( p_map->p_mapped, p_map->i_mapped );
+#else
+        free( p_map->p_mapped );
+#endif
+    }
+    else
+        free( p_map->p_slots );
+    DrcsMapInit( p_map );
+}
+
+static int DrcsMapGrow( drcs_map_t *p_map )
+{
+    size_t i_slots = p_map->p_slots ? 2 * ( p_map->i_mask + 1 ) : DRCSMAP_MIN_SLOTS;
+    drcs_map_t map;
+
+    map.p_slots = calloc( i_slots, sizeof(*map.p_slots) );
+    if( map.p_slots == NULL )
+        return -1;
+    map.i_mask = i_slots - 1;
+    map.i_count = 0;
+    map.p_mapped = NULL;
+    map.i_mapped = 0;
+
+    if( p_map->p_slots != NULL )
+    {
+        for( size_t i = 0; i <= p_map->i_mask; i++ )
+        {
+            if( p_map->p_slots[i].i_code != 0 )
+                DrcsMapAdd( &map, p_map->p_slots[i].digest, p_map->p_slots[i].i_code );
+        }
+        free( p_map->p_slots );
+    }
+    *p_map = map;
+    return 0;
+}
+
+/* A digest already present keeps its first code, as the ini list did */
+int DrcsMapAdd( drcs_map_t *p_map, const uint8_t *p_digest, unsigned int i_code )
+{
+    if( i_code == 0 || p_map->p_mapped != NULL )
+        return -1;
+    if( p_map->p_slots == NULL || 2 * ( p_map->i_count + 1 ) > p_map->i_mask + 1 )
+    {
+        if( DrcsMapGrow( p_map ) )
+            return -1;
+    }
+
+    for( size_t i = DrcsMapSlot( p_map, p_digest ); ; i = ( i + 1 ) & p_map->i_mask )
+    {
+        drcs_map_entry_t *p_entry = &p_map->p_slots[i];
+        if( p_entry->i_code == 0 )
+        {
+            memcpy( p_entry->digest, p_digest, DRCS_DIGEST_SIZE );
+            p_entry->i_code = i_code;
+            p_map->i_count++;
+            return 0;
+        }
+        if( !memcmp( p_entry->digest, p_digest, DRCS_DIGEST_SIZE ) )
+            return 0;
+    }
+}
+
+unsigned int DrcsMapGet( const drcs_map_t *p_map, const uint8_t *p_digest )
+{
+    if( p_map == NULL || p_map->p_slots == NULL )
+        return 0;
+
+    /* a corrupt cache may have no empty slot left */
+    size_t i = DrcsMapSlot( p_map, p_digest );
+    for( size_t i_probe = 0; i_probe <= p_map->i_mask; i_probe++ )
+    {
+        const drcs_map_entry_t *p_entry = &p_map->p_slots[i];
+        if( p_entry->i_code == 0 )
+            return 0;
+        if( !memcmp( p_entry->digest, p_digest, DRCS_DIGEST_SIZE ) )
+            return p_entry->i_code;
+        i = ( i + 1 ) & p_map->i_mask;
+    }
+    return 0;
+}
+
+int DrcsMapSave( const drcs_map_t *p_map, const char *psz_file,
+                 int64_t i_size, int64_t i_mtime )
+{
+    drcs_map_header_t hdr;
+    char *psz_tmp;
+    FILE *fp;
+    int i_ret = 0;
+
+    memset( &hdr, 0, sizeof(hdr) );
+    memcpy( hdr.psz_magic, DRCSMAP_MAGIC, 8 );
+    hdr.i_size = i_size;
+    hdr.i_mtime = i_mtime;
+    hdr.i_entry_size = sizeof(drcs_map_entry_t);
+    hdr.i_slots = p_map->p_slots ? p_map->i_mask + 1 : 0;
+    hdr.i_count = p_map->i_count;
+
+    /* workers rebuilding at the same time must not share a temporary */
+    if( asprintf( &psz_tmp, "%s.%ld.tmp", psz_file, (long)getpid() ) < 0 )
+        return -1;
+    fp = vlc_fopen( psz_tmp, "wb" );
+    if( fp == NULL )
+    {
+        free( psz_tmp );
+        return -1;
+    }
+
+    if( fwrite( &hdr, sizeof(hdr), 1, fp ) != 1 )
+        i_ret = -1;
+    if( hdr.i_slots > 0 &&
+        fwrite( p_map->p_slots, sizeof(drcs_map_entry_t), hdr.i_slots, fp ) != hdr.i_slots )
+        i_ret = -1;
+
+    if( fclose( fp ) != 0 )
+        i_ret = -1;
+    if( i_ret == 0 && rename( psz_tmp, psz_file ) != 0 )
+        i_ret = -1;
+    if( i_ret != 0 )
+        unlink( psz_tmp );
+    free( psz_tmp );
+    return i_ret;
+}
+
+/* -1 when there is no cache or it was built from another ini */
+int DrcsMapLoad( drcs_map_t *p_map, const char *psz_file,
+                 int64_t i_size, int64_t i_mtime )
+{
+    drcs_map_header_t hdr;
+    struct stat st;
+    void *p_mapped = NULL;
+
+    int fd = open( psz_file, O_RDONLY );
+    if( fd < 0 )
+        return -1;
+
+    if( fstat( fd, &st ) != 0 || (uint64_t)st.st_size < sizeof(hdr) ||
+        read( fd, &hdr, sizeof(hdr) ) != sizeof(hdr) )
+        goto error;
+    if( memcmp( hdr.psz_magic, DRCSMAP_MAGIC, 8 ) ||
+        hdr.i_size != i_size || hdr.i_mtime != i_mtime ||
+        hdr.i_entry_size != sizeof(drcs_map_entry_t) )
+        goto error;
+    /* the probe loops rely on a power of two kept at most half full */
+    if( ( hdr.i_slots & ( hdr.i_slots - 1 ) ) != 0 ||
+        hdr.i_slots > SIZE_MAX / sizeof(drcs_map_entry_t) / 2 ||
+        2 * hdr.i_count > hdr.i_slots ||
+        (uint64_t)st.st_size != sizeof(hdr) + hdr.i_slots * sizeof(drcs_map_entry_t) )
+        goto error;
+
+    if( hdr.i_slots > 0 )
+    {
+#ifdef HAVE_SYS_MMAN_H
+        p_mapped = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+        if( p_mapped == MAP_FAILED )
+            goto error;
+#else
+        p_mapped = malloc( st.st_size );
+        if( p_mapped == NULL || lseek( fd, 0, SEEK_SET ) != 0 ||
+            read( fd, p_mapped, st.st_size ) != st.st_size )
+        {
+            free( p_mapped );
+            goto error;
+        }
+#endif
+    }
+    close( fd );
+
+    DrcsMapClean( p_map );
+    if( p_mapped != NULL )
+    {
+        p_map->p_mapped = p_mapped;
+        p_map->i_mapped = st.st_size;
+        p_map->p_slots = (drcs_map_entry_t *)( (uint8_t *)p_mapped + sizeof(hdr) );
+        p_map->i_mask = hdr.i_slots - 1;
+        p_map->i_count = hdr.i_count;
+    }
+    return 0;
+
+error:
+    close( fd );
+    return -1;
+}
+
+unsigned int DrcsConvGet( const drcs_map_t *p_overlay, const uint8_t *p_digest )
+{
+    unsigned int i_code = DrcsMapGet( p_overlay, p_digest );
+    if( i_code != 0 || DRCS_CONV_BUILTIN_COUNT == 0 )
+        return i_code;
+
+    uint32_t i_bucket = DrcsPhfBucket( p_digest, DRCS_CONV_BUILTIN_BUCKETS );
+    const drcs_map_entry_t *p_entry = &drcs_conv_builtin[
+        DrcsPhfSlot( p_digest, drcs_conv_builtin_disp[i_bucket],
+                     DRCS_CONV_BUILTIN_COUNT ) ];
+    if( memcmp( p_entry->digest, p_digest, DRCS_DIGEST_SIZE ) )
+        return 0;
+    return p_entry->i_code;
+}
@@ -0,0 +1,146 @@
+/*****************************************************************************
+ * drcsmap.h: DRCS pattern digest to code point table
+ *****************************************************************************
+ * Keys are the 16-byte MD5 digests of DRCS patterns. Open addressing with
+ * linear probing; the digest is already uniformly spread, so its first
+ * bytes are used as the hash.
+ *
+ * The drcs_conv.ini shipped with the sources is compiled into a constant
+ * table by drcs_conv_gen; a drcs_conv.ini found at run time only overlays it.
+ * The overlay is cached next to the ini as drcs_conv.bin, the slot array
+ * written as is, and mapped read-only by later runs so that processes
+ * started together share its pages.
+ *****************************************************************************/
+
+#ifndef DRCSMAP_H
+# define DRCSMAP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DRCS_DIGEST_SIZE    16
+
+typedef struct drcs_map_entry_s
+{
+    uint8_t         digest[DRCS_DIGEST_SIZE];
+    unsigned int    i_code;     /* 0 marks an empty slot */
+} drcs_map_entry_t;
+
+typedef struct drcs_map_s
+{
+    drcs_map_entry_t *p_slots;
+    size_t          i_mask;     /* slot count - 1, a power of two */
+    size_t          i_count;
+    void            *p_mapped;  /* cache file backing p_slots, read-only */
+    size_t          i_mapped;
+} drcs_map_t;
+
+/*
+ * Minimal perfect hash of the built-in table, shared with drcs_conv_gen:
+ * the first half of the digest picks a bucket, and the displacement stored
+ * for that bucket sends the second half to a slot of its own.
+ */
+static inline uint64_t DrcsLoad64( const uint8_t *p )
+{
+    uint64_t i_word = 0;
+    for( int i = 7; i >= 0; i-- )
+        i_word = ( i_word << 8 ) | p[i];
+    return i_word;
+}
+
+static inline uint32_t DrcsPhfBucket( const uint8_t *p_digest, uint32_t i_buckets )
+{
+    return DrcsLoad64( p_digest ) % i_buckets;
+}
+
+static inline uint32_t DrcsPhfSlot( const uint8_t *p_digest, uint32_t i_disp,
+                                    uint32_t i_slots )
+{
+    uint64_t i_word = DrcsLoad64( p_digest + 8 ) ^
+                      (uint64_t)i_disp * UINT64_C(0x9e3779b97f4a7c15);
+    i_word ^= i_word >> 31;
+    i_word *= UINT64_C(0xbf58476d1ce4e5b9);
+    i_word ^= i_word >> 29;
+    return i_word % i_slots;
+}
+
+static inline int DrcsHexValue( char c )
+{
+    if( c >= '0' && c <= '9' )
+        return c - '0';
+    if( c >= 'a' && c <= 'f' )
+        return c - 'a' + 10;
+    if( c >= 'A' && c <= 'F' )
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* 32 hex digits to a digest, -1 if any of them is not hex */
+static inline int DrcsDigestFromHex( uint8_t *p_digest, const char *psz_hex )
+{
+    for( int i = 0; i < DRCS_DIGEST_SIZE; i++ )
+    {
+        int i_hi = DrcsHexValue( psz_hex[2 * i] );
+        int i_lo = i_hi < 0 ? -1 : DrcsHexValue( psz_hex[2 * i + 1] );
+        if( i_lo < 0 )
+            return -1;
+        p_digest[i] = ( i_hi << 4 ) | i_lo;
+    }
+    return 0;
+}
+
+/* psz_hex must hold 33 bytes */
+static inline char *DrcsDigestToHex( char *psz_hex, const uint8_t *p_digest )
+{
+    static const char hex[] = "0123456789abcdef";
+    for( int i = 0; i < DRCS_DIGEST_SIZE; i++ )
+    {
+        psz_hex[2 * i] = hex[p_digest[i] >> 4];
+        psz_hex[2 * i + 1] = hex[p_digest[i] & 0xf];
+    }
+    psz_hex[2 * DRCS_DIGEST_SIZE] = '\0';
+    return psz_hex;
+}
+
+/*
+ * One "<32 hex digits>=U+<code>" line of drcs_conv.ini, -1 for comments
+ * and anything malformed. The trailing newline is stripped in place.
+ */
+static inline int DrcsConvParseLine( char *buf, uint8_t *p_digest,
+                                     unsigned int *pi_code )
+{
+    if( buf[0] == ';' || buf[0] == '#' ) // comment
+        return -1;
+
+    char *p_ret = strchr( buf, '\n' );
+    if( p_ret != NULL )
+        *p_ret = '\0';
+
+    char *p_eq = strchr( buf, '=' );
+    if( p_eq == NULL || p_eq - buf != 32 )
+        return -1;
+    char *p_code = strstr( buf, "U+" );
+    if( p_code == NULL || strlen( p_code ) < 2 || strlen( p_code ) > 8 )
+        return -1;
+    if( DrcsDigestFromHex( p_digest, buf ) )
+        return -1;
+
+    unsigned long code = strtoul( p_code + 2, NULL, 16 );
+    if( code == 0 || code > 0x10ffff )
+        return -1;
+    *pi_code = code;
+    return 0;
+}
+
+void DrcsMapInit( drcs_map_t * );
+void DrcsMapClean( drcs_map_t * );
+int  DrcsMapAdd( drcs_map_t *, const uint8_t *, unsigned int );
+unsigned int DrcsMapGet( const drcs_map_t *, const uint8_t * );
+/* size and mtime of the source ini; Load fails when they differ */
+int  DrcsMapSave( const drcs_map_t *, const char *, int64_t, int64_t );
+int  DrcsMapLoad( drcs_map_t *, const char *, int64_t, int64_t );
+/* drcs_conv.ini overlay first, then the table built in from the shipped ini */
+unsigned int DrcsConvGet( const drcs_map_t *, const uint8_t * );
+
+#endif
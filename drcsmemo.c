@@ -0,0 +1,148 @@
+/*****************************************************************************
+ * drcsmemo.c: raw DRCS pattern to digest memo
+ *****************************************************************************
+ * Open addressing with linear probing, kept at most half full like the
+ * digest tables of drcsmap.c. Entries are never removed.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "common.h"
+#include "arena.h"
+#include "drcsmap.h"
+#include "drcsmemo.h"
+
+#define DRCSMEMO_MIN_SLOTS  64
+#define DRCSMEMO_MUL        UINT64_C(0x9e3779b97f4a7c15)
+
+void DrcsMemoInit( drcs_memo_t *p_memo )
+{
+    p_memo->p_slots = NULL;
+    p_memo->i_mask = 0;
+    p_memo->i_count = 0;
+    ArenaInit( &p_memo->patterns );
+}
+
+void DrcsMemoClean( drcs_memo_t *p_memo )
+{
+    free( p_memo->p_slots );
+    ArenaClean( &p_memo->patterns );
+    DrcsMemoInit( p_memo );
+}
+
+/* Eight bytes per multiply; only has to tell patterns apart, not resist
+ * anyone, since every hit is confirmed byte by byte */
+uint64_t DrcsMemoHash( int i_width, int i_height, int i_depth,
+                       const uint8_t *p_pattern, size_t i_size )
+{
+    uint64_t i_hash = ( (uint64_t)i_width << 48 ) ^ ( (uint64_t)i_height << 32 ) ^
+                      ( (uint64_t)i_depth << 24 ) ^ i_size;
+    size_t i = 0;
+    for( ; i + 8 <= i_size; i += 8 )
+    {
+        uint64_t i_word;
+        memcpy( &i_word, &p_pattern[i], 8 );
+        i_hash = ( i_hash ^ i_word ) * DRCSMEMO_MUL;
+        i_hash ^= i_hash >> 32;
+    }
+    for( ; i < i_size; i++ )
+        i_hash = ( i_hash ^ p_pattern[i] ) * DRCSMEMO_MUL;
+    i_hash ^= i_hash >> 29;
+    return i_hash;
+}
+
+static bool DrcsMemoMatch( const drcs_memo_entry_t *p_entry, uint64_t i_hash,
+                           int i_width, int i_height, int i_depth,
+                           const uint8_t *p_pattern, size_t i_size )
+{
+    return p_entry->i_hash == i_hash && p_entry->i_size == i_size &&
+           p_entry->i_width == i_width && p_entry->i_height == i_height &&
+           p_entry->i_depth == i_depth &&
+           !memcmp( p_entry->p_pattern, p_pattern, i_size );
+}
+
+const uint8_t *DrcsMemoGet( const drcs_memo_t *p_memo, uint64_t i_hash,
+                            int i_width, int i_height, int i_depth,
+                            const uint8_t *p_pattern, size_t i_size )
+{
+    if( p_memo->p_slots == NULL )
+        return NULL;
+
+    for( size_t i = i_hash & p_memo->i_mask; ; i = ( i + 1 ) & p_memo->i_mask )
+    {
+        const drcs_memo_entry_t *p_entry = &p_memo->p_slots[i];
+        if( p_entry->p_pattern == NULL )
+            return NULL;
+        if( DrcsMemoMatch( p_entry, i_hash, i_width, i_height, i_depth,
+                           p_pattern, i_size ) )
+            return p_entry->digest;
+    }
+}
+
+static int DrcsMemoGrow( drcs_memo_t *p_memo )
+{
+    size_t i_slots = p_memo->p_slots ? 2 * ( p_memo->i_mask + 1 ) : DRCSMEMO_MIN_SLOTS;
+    drcs_memo_entry_t *p_slots = calloc( i_slots, sizeof(*p_slots) );
+    if( p_slots == NULL )
+        return -1;
+
+    if( p_memo->p_slots != NULL )
+    {
+        for( size_t i = 0; i <= p_memo->i_mask; i++ )
+        {
+            const drcs_memo_entry_t *p_entry = &p_memo->p_slots[i];
+            if( p_entry->p_pattern == NULL )
+                continue;
+            size_t j = p_entry->i_hash & ( i_slots - 1 );
+            while( p_slots[j].p_pattern != NULL )
+                j = ( j + 1 ) & ( i_slots - 1 );
+            p_slots[j] = *p_entry;
+        }
+        free( p_memo->p_slots );
+    }
+    p_memo->p_slots = p_slots;
+    p_memo->i_mask = i_slots - 1;
+    return 0;
+}
+
+int DrcsMemoAdd( drcs_memo_t *p_memo, uint64_t i_hash,
+                 int i_width, int i_height, int i_depth,
+                 const uint8_t *p_pattern, size_t i_size, const uint8_t *p_digest )
+{
+    if( p_memo->i_count >= DRCSMEMO_MAX_ENTRIES || i_size > UINT32_MAX )
+        return -1;
+    if( p_memo->p_slots == NULL || 2 * ( p_memo->i_count + 1 ) > p_memo->i_mask + 1 )
+    {
+        if( DrcsMemoGrow( p_memo ) )
+            return -1;
+    }
+
+    size_t i = i_hash & p_memo->i_mask;
+    for( ; p_memo->p_slots[i].p_pattern != NULL; i = ( i + 1 ) & p_memo->i_mask )
+    {
+        if( DrcsMemoMatch( &p_memo->p_slots[i], i_hash, i_width, i_height,
+                           i_depth, p_pattern, i_size ) )
+            return 0;
+    }
+
+    uint8_t *p_copy = ArenaAlloc( &p_memo->patterns, i_size ? i_size : 1 );
+    if( p_copy == NULL )
+        return -1;
+    memcpy( p_copy, p_pattern, i_size );
+
+    drcs_memo_entry_t *p_entry = &p_memo->p_slots[i];
+    p_entry->i_hash = i_hash;
+    p_entry->p_pattern = p_copy;
+    p_entry->i_size = i_size;
+    p_entry->i_width = i_width;
+    p_entry->i_height = i_height;
+    p_entry->i_depth = i_depth;
+    memcpy( p_entry->digest, p_digest, DRCS_DIGEST_SIZE );
+    p_memo->i_count++;
+    return 0;
+}
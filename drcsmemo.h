@@ -0,0 +1,43 @@
+/*****************************************************************************
+ * drcsmemo.h: raw DRCS pattern to digest memo
+ *****************************************************************************
+ * Broadcasters resend the same DRCS patterns with every caption using them.
+ * The memo remembers the MD5 digest of each distinct pattern, found by a
+ * cheap hash of its geometry and bytes and confirmed by comparing the bytes,
+ * so MD5 runs once per glyph and stream.
+ *****************************************************************************/
+
+#ifndef DRCSMEMO_H
+# define DRCSMEMO_H
+
+#define DRCSMEMO_MAX_ENTRIES    4096    /* beyond that patterns are hashed */
+
+typedef struct drcs_memo_entry_s
+{
+    uint64_t        i_hash;
+    const uint8_t   *p_pattern; /* NULL marks an empty slot */
+    uint32_t        i_size;
+    uint8_t         i_width;
+    uint8_t         i_height;
+    uint8_t         i_depth;
+    uint8_t         digest[DRCS_DIGEST_SIZE];
+} drcs_memo_entry_t;
+
+typedef struct drcs_memo_s
+{
+    drcs_memo_entry_t *p_slots;
+    size_t          i_mask;     /* slot count - 1, a power of two */
+    size_t          i_count;
+    arena_t         patterns;   /* copies of the memoized patterns */
+} drcs_memo_t;
+
+void DrcsMemoInit( drcs_memo_t * );
+void DrcsMemoClean( drcs_memo_t * );
+uint64_t DrcsMemoHash( int, int, int, const uint8_t *, size_t );
+/* digest of a pattern seen before, NULL otherwise */
+const uint8_t *DrcsMemoGet( const drcs_memo_t *, uint64_t,
+                            int, int, int, const uint8_t *, size_t );
+int  DrcsMemoAdd( drcs_memo_t *, uint64_t,
+                  int, int, int, const uint8_t *, size_t, const uint8_t * );
+
+#endif
@@ -0,0 +1,181 @@
+/*****************************************************************************
+ * drcspng.c: DRCS patterns as 1 bit PNG images
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <math.h>
+
+#include "common.h"
+#include "vlc_bits.h"
+#include "drcspng.h"
+
+#include "png.h"
+
+/* four 2-bit pixels to their four "not background" bits, first pixel high */
+#define DRCS_LUT2(b)    ( ( (b) & 0xc0 ? 8 : 0 ) | ( (b) & 0x30 ? 4 : 0 ) | \
+                          ( (b) & 0x0c ? 2 : 0 ) | ( (b) & 0x03 ? 1 : 0 ) )
+#define DRCS_LUT2_4(b)  DRCS_LUT2(b), DRCS_LUT2(b + 1), DRCS_LUT2(b + 2), DRCS_LUT2(b + 3)
+#define DRCS_LUT2_16(b) DRCS_LUT2_4(b), DRCS_LUT2_4(b + 4), DRCS_LUT2_4(b + 8), DRCS_LUT2_4(b + 12)
+#define DRCS_LUT2_64(b) DRCS_LUT2_16(b), DRCS_LUT2_16(b + 16), DRCS_LUT2_16(b + 32), DRCS_LUT2_16(b + 48)
+static const uint8_t drcs_lut2[256] =
+{
+    DRCS_LUT2_64(0), DRCS_LUT2_64(64), DRCS_LUT2_64(128), DRCS_LUT2_64(192)
+};
+
+/* 2-bit patterns, the usual ones, go a byte at a time through drcs_lut2;
+ * deeper ones are read pixel by pixel */
+void DrcsPackPattern( uint8_t *p_bits,
+        int i_width, int i_height, int i_depth, const int8_t *p_patternData )
+{
+    int i_bits_per_pixel = ceil( sqrt( ( i_depth ) ) );
+    size_t i_pixels = (size_t)i_width * i_height;
+    const uint8_t *p_src = (const uint8_t *)p_patternData;
+
+    memset( p_bits, 0, ( i_pixels + 7 ) / 8 );
+    if( i_bits_per_pixel == 2 )
+    {
+        for( size_t k = 0; k < i_pixels / 4; k++ )
+            p_bits[k / 2] |= drcs_lut2[p_src[k]] << ( k & 1 ? 0 : 4 );
+    }
+    else
+    {
+        bs64_t bs;
+        bs64_init( &bs, p_patternData, i_pixels * i_bits_per_pixel / 8 );
+        for( size_t k = 0; k < i_pixels; k++ )
+            if( bs64_read( &bs, i_bits_per_pixel ) )
+                p_bits[k / 8] |= 0x80 >> ( k % 8 );
+    }
+}
+
+/* the PNG is encoded here, then written by the caller */
+typedef struct
+{
+    uint8_t *p_data;
+    size_t  i_size;
+    size_t  i_max;
+} png_mem_t;
+
+static void png_mem_write( png_structp png_ptr, png_bytep p_data, png_size_t i_size )
+{
+    png_mem_t *p_mem = png_get_io_ptr( png_ptr );
+    if( p_mem->i_size + i_size > p_mem->i_max )
+    {
+        size_t i_max = __MAX( 2 * p_mem->i_max, p_mem->i_size + i_size );
+        uint8_t *p_new = realloc( p_mem->p_data, i_max );
+        if( p_new == NULL )
+            png_error( png_ptr, "out of memory" );
+        p_mem->p_data = p_new;
+        p_mem->i_max = i_max;
+    }
+    memcpy( p_mem->p_data + p_mem->i_size, p_data, i_size );
+    p_mem->i_size += i_size;
+}
+
+static void png_mem_flush( png_structp png_ptr )
+{
+    VLC_UNUSED( png_ptr );
+}
+
+/* rows are shifted out of the packed bits into a single row buffer */
+int DrcsPngEncode( uint8_t **pp_data, size_t *pi_size,
+        int i_width, int i_height,
+        int i_depth, const int8_t* p_patternData )
+{
+    size_t i_bits = ( (size_t)i_width * i_height + 7 ) / 8;
+    size_t i_row = ( i_width + 7 ) / 8;
+    png_mem_t mem = { NULL, 0, 0 };
+
+    *pp_data = NULL;
+    /* one spare byte, read when shifting the last row into place */
+    uint8_t *p_bits = malloc( i_bits + 1 + i_row );
+    if( p_bits == NULL )
+    {
+        return -1;
+    }
+    uint8_t *p_row = p_bits + i_bits + 1;
+    DrcsPackPattern( p_bits, i_width, i_height, i_depth, p_patternData );
+    p_bits[i_bits] = 0;
+
+    png_structp png_ptr = png_create_write_struct(
+            PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
+    if( png_ptr == NULL )
+    {
+        goto png_create_write_struct_failed;
+    }
+    png_infop info_ptr = png_create_info_struct( png_ptr );
+    if( info_ptr == NULL )
+    {
+        goto png_create_info_struct_failed;
+    }
+
+    if( setjmp( png_jmpbuf( png_ptr ) ) )
+    {
+        goto png_failure;
+    }
+
+    png_set_write_fn( png_ptr, &mem, png_mem_write, png_mem_flush );
+    png_set_filter( png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE );
+    png_set_compression_level( png_ptr, 1 ); /* Z_BEST_SPEED */
+
+    png_set_IHDR( png_ptr,
+            info_ptr,
+            i_width,
+            i_height,
+            1,
+            PNG_COLOR_TYPE_PALETTE,
+            PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_DEFAULT,
+            PNG_FILTER_TYPE_DEFAULT );
+
+    png_byte trans_values[1];
+    trans_values[0] = (png_byte)0;
+    png_set_tRNS( png_ptr, info_ptr, trans_values, 1, NULL );
+
+    int colors[][3] =
+    {
+        {255, 255, 255}, /* background */
+        {  0,   0,   0}, /* foreground */
+    };
+    png_color palette[2];
+    for( int i = 0; i < 2; i++ )
+    {
+        palette[i].red = colors[i][0];
+        palette[i].green = colors[i][1];
+        palette[i].blue = colors[i][2];
+    }
+    png_set_PLTE( png_ptr, info_ptr, palette, 2 );
+
+    png_write_info( png_ptr, info_ptr );
+    for( int j = 0; j < i_height; j++ )
+    {
+        size_t i_bit = (size_t)j * i_width;
+        const uint8_t *p_src = &p_bits[i_bit / 8];
+        int i_shift = i_bit % 8;
+
+        if( i_shift == 0 )
+            memcpy( p_row, p_src, i_row );
+        else
+            for( size_t k = 0; k < i_row; k++ )
+                p_row[k] = ( p_src[k] << i_shift ) | ( p_src[k + 1] >> ( 8 - i_shift ) );
+        if( i_width % 8 )
+            p_row[i_row - 1] &= 0xff << ( 8 - i_width % 8 );
+        png_write_row( png_ptr, p_row );
+    }
+    png_write_end( png_ptr, info_ptr );
+
+    *pp_data = mem.p_data;
+    *pi_size = mem.i_size;
+    mem.p_data = NULL;
+
+png_failure:
+png_create_info_struct_failed:
+    png_destroy_write_struct( &png_ptr, &info_ptr );
+png_create_write_struct_failed:
+    free( mem.p_data );
+    free( p_bits );
+    return *pp_data != NULL ? 0 : -1;
+}
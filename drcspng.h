@@ -0,0 +1,19 @@
+/*****************************************************************************
+ * drcspng.h: DRCS patterns as 1 bit PNG images
+ *****************************************************************************
+ * The images of data/ are tiny and many: the pattern is packed to one bit
+ * per pixel once, then encoded without filtering and at the fastest zlib
+ * level, into memory.
+ *****************************************************************************/
+
+#ifndef DRCSPNG_H
+# define DRCSPNG_H
+
+/* one bit per pixel, set where the pixel is not background, first pixel in
+ * the high bit and rows not padded; p_bits holds (w * h + 7) / 8 bytes */
+void DrcsPackPattern( uint8_t *p_bits, int, int, int, const int8_t * );
+/* the PNG in a malloc()ed *pp_data, -1 on error */
+int  DrcsPngEncode( uint8_t **pp_data, size_t *pi_size,
+                    int, int, int, const int8_t * );
+
+#endif
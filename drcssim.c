@@ -0,0 +1,219 @@
+/*****************************************************************************
+ * drcssim.c: look-alike search among the known DRCS glyphs
+ *****************************************************************************
+ * The fingerprints are kept one after the other, so that the search is a
+ * straight pass of xor and popcount over the whole index; with AVX2 one
+ * fingerprint fits a register and its popcount is done by nibble lookups.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "common.h"
+#include "drcsmap.h"
+#include "drcssim.h"
+
+#define DRCS_SIMILAR_MIN_REFS   64
+#define DRCS_SIMILAR_BLOCK      256     /* distances computed at once */
+
+void DrcsSimilarInit( drcs_similar_t *p_sim )
+{
+    DrcsMapInit( &p_sim->index );
+    p_sim->p_fingerprints = NULL;
+    p_sim->pi_code = NULL;
+    p_sim->p_digest = NULL;
+    p_sim->i_count = 0;
+    p_sim->i_max = 0;
+}
+
+void DrcsSimilarClean( drcs_similar_t *p_sim )
+{
+    DrcsMapClean( &p_sim->index );
+    free( p_sim->p_fingerprints );
+    free( p_sim->pi_code );
+    free( p_sim->p_digest );
+    DrcsSimilarInit( p_sim );
+}
+
+/* a cell is set when at least half of the pixels it covers are */
+void DrcsFingerprint( uint64_t *p_fp, const uint8_t *p_bits,
+                      int i_width, int i_height )
+{
+    for( int i = 0; i < DRCS_SIMILAR_WORDS; i++ )
+        p_fp[i] = 0;
+
+    for( int gy = 0; gy < DRCS_SIMILAR_GRID; gy++ )
+    {
+        int y0 = gy * i_height / DRCS_SIMILAR_GRID;
+        int y1 = ( ( gy + 1 ) * i_height + DRCS_SIMILAR_GRID - 1 ) / DRCS_SIMILAR_GRID;
+        for( int gx = 0; gx < DRCS_SIMILAR_GRID; gx++ )
+        {
+            int x0 = gx * i_width / DRCS_SIMILAR_GRID;
+            int x1 = ( ( gx + 1 ) * i_width + DRCS_SIMILAR_GRID - 1 ) / DRCS_SIMILAR_GRID;
+            int i_ink = 0;
+            for( int y = y0; y < y1; y++ )
+                for( int x = x0; x < x1; x++ )
+                {
+                    size_t k = (size_t)y * i_width + x;
+                    i_ink += ( p_bits[k / 8] >> ( 7 - k % 8 ) ) & 1;
+                }
+            if( i_ink > 0 && 2 * i_ink >= ( x1 - x0 ) * ( y1 - y0 ) )
+            {
+                int k = gy * DRCS_SIMILAR_GRID + gx;
+                p_fp[k / 64] |= UINT64_C(1) << ( k % 64 );
+            }
+        }
+    }
+}
+
+int DrcsSimilarAdd( drcs_similar_t *p_sim, const uint8_t *p_digest,
+                    const uint64_t *p_fp, unsigned int i_code )
+{
+    if( DrcsMapGet( &p_sim->index, p_digest ) != 0 )
+        return 0;
+
+    if( p_sim->i_count == p_sim->i_max )
+    {
+        unsigned int i_max = p_sim->i_max ? 2 * p_sim->i_max : DRCS_SIMILAR_MIN_REFS;
+        uint64_t *p_fingerprints = realloc( p_sim->p_fingerprints,
+                i_max * DRCS_SIMILAR_WORDS * sizeof(*p_fingerprints) );
+        if( p_fingerprints == NULL )
+            return -1;
+        p_sim->p_fingerprints = p_fingerprints;
+        unsigned int *pi_code = realloc( p_sim->pi_code, i_max * sizeof(*pi_code) );
+        if( pi_code == NULL )
+            return -1;
+        p_sim->pi_code = pi_code;
+        uint8_t (*p_new)[DRCS_DIGEST_SIZE] = realloc( p_sim->p_digest,
+                i_max * sizeof(*p_new) );
+        if( p_new == NULL )
+            return -1;
+        p_sim->p_digest = p_new;
+        p_sim->i_max = i_max;
+    }
+
+    unsigned int i = p_sim->i_count;
+    if( DrcsMapAdd( &p_sim->index, p_digest, i + 1 ) )
+        return -1;
+    memcpy( &p_sim->p_fingerprints[i * DRCS_SIMILAR_WORDS], p_fp,
+            DRCS_SIMILAR_WORDS * sizeof(*p_fp) );
+    memcpy( p_sim->p_digest[i], p_digest, DRCS_DIGEST_SIZE );
+    p_sim->pi_code[i] = i_code;
+    p_sim->i_count++;
+    return 0;
+}
+
+static inline unsigned int DrcsPopcount( uint64_t i_word )
+{
+#ifdef __GNUC__
+    return __builtin_popcountll( i_word );
+#else
+    i_word -= ( i_word >> 1 ) & UINT64_C(0x5555555555555555);
+    i_word = ( i_word & UINT64_C(0x3333333333333333) ) +
+             ( ( i_word >> 2 ) & UINT64_C(0x3333333333333333) );
+    i_word = ( i_word + ( i_word >> 4 ) ) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+    return ( i_word * UINT64_C(0x0101010101010101) ) >> 56;
+#endif
+}
+
+static void DrcsDistances( const uint64_t *p_refs, unsigned int i_count,
+                           const uint64_t *p_fp, uint16_t *pi_dist )
+{
+    for( unsigned int i = 0; i < i_count; i++ )
+    {
+        unsigned int i_dist = 0;
+        for( int j = 0; j < DRCS_SIMILAR_WORDS; j++ )
+            i_dist += DrcsPopcount( p_refs[i * DRCS_SIMILAR_WORDS + j] ^ p_fp[j] );
+        pi_dist[i] = i_dist;
+    }
+}
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) ) && \
+    DRCS_SIMILAR_WORDS == 4
+# include <immintrin.h>
+# define DRCS_SIMILAR_AVX2 1
+
+__attribute__((target("avx2")))
+static void DrcsDistancesAvx2( const uint64_t *p_refs, unsigned int i_count,
+                               const uint64_t *p_fp, uint16_t *pi_dist )
+{
+    const __m256i lut = _mm256_setr_epi8( 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 );
+    const __m256i nibble = _mm256_set1_epi8( 0x0f );
+    const __m256i fp = _mm256_loadu_si256( (const __m256i *)p_fp );
+
+    for( unsigned int i = 0; i < i_count; i++ )
+    {
+        __m256i x = _mm256_xor_si256( fp,
+                _mm256_loadu_si256( (const __m256i *)&p_refs[4 * i] ) );
+        __m256i lo = _mm256_shuffle_epi8( lut, _mm256_and_si256( x, nibble ) );
+        __m256i hi = _mm256_shuffle_epi8( lut,
+                _mm256_and_si256( _mm256_srli_epi16( x, 4 ), nibble ) );
+        /* byte counts summed into the four 64-bit lanes */
+        __m256i sum = _mm256_sad_epu8( _mm256_add_epi8( lo, hi ),
+                                       _mm256_setzero_si256() );
+        __m128i half = _mm_add_epi64( _mm256_castsi256_si128( sum ),
+                                      _mm256_extracti128_si256( sum, 1 ) );
+        pi_dist[i] = _mm_cvtsi128_si32( half ) + _mm_extract_epi16( half, 4 );
+    }
+}
+
+static bool DrcsHasAvx2( void )
+{
+    static int i_avx2 = -1;
+    if( i_avx2 < 0 )
+    {
+        __builtin_cpu_init();
+        i_avx2 = __builtin_cpu_supports( "avx2" ) ? 1 : 0;
+    }
+    return i_avx2;
+}
+#endif
+
+int DrcsSimilarMatch( const drcs_similar_t *p_sim, const uint64_t *p_fp,
+                      unsigned int *pi_distance )
+{
+    uint16_t pi_dist[DRCS_SIMILAR_BLOCK];
+    unsigned int i_best = UINT_MAX, i_other = UINT_MAX;
+    int i_match = -1;
+
+    for( unsigned int i = 0; i < p_sim->i_count; i += DRCS_SIMILAR_BLOCK )
+    {
+        unsigned int i_block = p_sim->i_count - i < DRCS_SIMILAR_BLOCK ?
+                               p_sim->i_count - i : DRCS_SIMILAR_BLOCK;
+        const uint64_t *p_refs = &p_sim->p_fingerprints[i * DRCS_SIMILAR_WORDS];
+#ifdef DRCS_SIMILAR_AVX2
+        if( DrcsHasAvx2() )
+            DrcsDistancesAvx2( p_refs, i_block, p_fp, pi_dist );
+        else
+#endif
+            DrcsDistances( p_refs, i_block, p_fp, pi_dist );
+
+        /* i_other: the nearest reference not of the code of the best one */
+        for( unsigned int j = 0; j < i_block; j++ )
+        {
+            unsigned int i_code = p_sim->pi_code[i + j];
+            if( pi_dist[j] < i_best )
+            {
+                if( i_match < 0 || p_sim->pi_code[i_match] != i_code )
+                    i_other = i_best;
+                i_best = pi_dist[j];
+                i_match = i + j;
+            }
+            else if( pi_dist[j] < i_other && p_sim->pi_code[i_match] != i_code )
+                i_other = pi_dist[j];
+        }
+    }
+
+    if( i_match < 0 || i_best > DRCS_SIMILAR_MAX_DISTANCE ||
+        ( i_other != UINT_MAX && i_other < i_best + DRCS_SIMILAR_MIN_GAP ) )
+        return -1;
+    if( pi_distance != NULL )
+        *pi_distance = i_best;
+    return i_match;
+}
@@ -0,0 +1,41 @@
+/*****************************************************************************
+ * drcssim.h: look-alike search among the known DRCS glyphs
+ *****************************************************************************
+ * drcs_conv.ini often lists a dozen digests for one code point, patterns
+ * that differ by a few pixels or by their size. Each known glyph is reduced
+ * to a fingerprint, its bitmap scaled to a 16x16 grid of bits, and an
+ * unknown glyph takes the code of the known one whose fingerprint differs
+ * in the fewest cells, when that one is close enough and clearly closer
+ * than any glyph of another code.
+ *****************************************************************************/
+
+#ifndef DRCSSIM_H
+# define DRCSSIM_H
+
+#define DRCS_SIMILAR_GRID       16
+#define DRCS_SIMILAR_WORDS      ( DRCS_SIMILAR_GRID * DRCS_SIMILAR_GRID / 64 )
+#define DRCS_SIMILAR_MAX_DISTANCE 16    /* differing cells for a match */
+#define DRCS_SIMILAR_MIN_GAP    8       /* to the nearest glyph of another code */
+
+typedef struct drcs_similar_s
+{
+    drcs_map_t      index;          /* digest to reference + 1 */
+    uint64_t        *p_fingerprints;/* DRCS_SIMILAR_WORDS per reference */
+    unsigned int    *pi_code;
+    uint8_t         (*p_digest)[DRCS_DIGEST_SIZE];
+    unsigned int    i_count;
+    unsigned int    i_max;
+} drcs_similar_t;
+
+void DrcsSimilarInit( drcs_similar_t * );
+void DrcsSimilarClean( drcs_similar_t * );
+/* of a 1 bpp bitmap, first pixel in the high bit, rows not padded */
+void DrcsFingerprint( uint64_t *, const uint8_t *, int, int );
+/* a glyph already in the index is not added again */
+int  DrcsSimilarAdd( drcs_similar_t *, const uint8_t *, const uint64_t *,
+                     unsigned int );
+/* the reference matching a fingerprint, -1 if none does */
+int  DrcsSimilarMatch( const drcs_similar_t *, const uint64_t *,
+                       unsigned int *pi_distance );
+
+#endif
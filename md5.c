@@ -347,3 +347,231 @@ void EndMD5( struct md5_s *h )
 {
     md5_final( h );
 }
+
+/*
+ * Batches: several messages hashed side by side, one per SIMD lane, for the
+ * DRCS patterns of a data unit. The lanes run the same 64 steps as
+ * transform() on their own block each; a lane whose message has no more
+ * blocks keeps its state while the longer ones finish. x86 only, picked at
+ * run time; elsewhere, or for a single message, the batch is hashed in turn.
+ */
+
+#define MD5_STEPS( OP ) \
+  OP (FF, A, B, C, D,  0,  7, 0xd76aa478); OP (FF, D, A, B, C,  1, 12, 0xe8c7b756); \
+  OP (FF, C, D, A, B,  2, 17, 0x242070db); OP (FF, B, C, D, A,  3, 22, 0xc1bdceee); \
+  OP (FF, A, B, C, D,  4,  7, 0xf57c0faf); OP (FF, D, A, B, C,  5, 12, 0x4787c62a); \
+  OP (FF, C, D, A, B,  6, 17, 0xa8304613); OP (FF, B, C, D, A,  7, 22, 0xfd469501); \
+  OP (FF, A, B, C, D,  8,  7, 0x698098d8); OP (FF, D, A, B, C,  9, 12, 0x8b44f7af); \
+  OP (FF, C, D, A, B, 10, 17, 0xffff5bb1); OP (FF, B, C, D, A, 11, 22, 0x895cd7be); \
+  OP (FF, A, B, C, D, 12,  7, 0x6b901122); OP (FF, D, A, B, C, 13, 12, 0xfd987193); \
+  OP (FF, C, D, A, B, 14, 17, 0xa679438e); OP (FF, B, C, D, A, 15, 22, 0x49b40821); \
+  OP (FG, A, B, C, D,  1,  5, 0xf61e2562); OP (FG, D, A, B, C,  6,  9, 0xc040b340); \
+  OP (FG, C, D, A, B, 11, 14, 0x265e5a51); OP (FG, B, C, D, A,  0, 20, 0xe9b6c7aa); \
+  OP (FG, A, B, C, D,  5,  5, 0xd62f105d); OP (FG, D, A, B, C, 10,  9, 0x02441453); \
+  OP (FG, C, D, A, B, 15, 14, 0xd8a1e681); OP (FG, B, C, D, A,  4, 20, 0xe7d3fbc8); \
+  OP (FG, A, B, C, D,  9,  5, 0x21e1cde6); OP (FG, D, A, B, C, 14,  9, 0xc33707d6); \
+  OP (FG, C, D, A, B,  3, 14, 0xf4d50d87); OP (FG, B, C, D, A,  8, 20, 0x455a14ed); \
+  OP (FG, A, B, C, D, 13,  5, 0xa9e3e905); OP (FG, D, A, B, C,  2,  9, 0xfcefa3f8); \
+  OP (FG, C, D, A, B,  7, 14, 0x676f02d9); OP (FG, B, C, D, A, 12, 20, 0x8d2a4c8a); \
+  OP (FH, A, B, C, D,  5,  4, 0xfffa3942); OP (FH, D, A, B, C,  8, 11, 0x8771f681); \
+  OP (FH, C, D, A, B, 11, 16, 0x6d9d6122); OP (FH, B, C, D, A, 14, 23, 0xfde5380c); \
+  OP (FH, A, B, C, D,  1,  4, 0xa4beea44); OP (FH, D, A, B, C,  4, 11, 0x4bdecfa9); \
+  OP (FH, C, D, A, B,  7, 16, 0xf6bb4b60); OP (FH, B, C, D, A, 10, 23, 0xbebfbc70); \
+  OP (FH, A, B, C, D, 13,  4, 0x289b7ec6); OP (FH, D, A, B, C,  0, 11, 0xeaa127fa); \
+  OP (FH, C, D, A, B,  3, 16, 0xd4ef3085); OP (FH, B, C, D, A,  6, 23, 0x04881d05); \
+  OP (FH, A, B, C, D,  9,  4, 0xd9d4d039); OP (FH, D, A, B, C, 12, 11, 0xe6db99e5); \
+  OP (FH, C, D, A, B, 15, 16, 0x1fa27cf8); OP (FH, B, C, D, A,  2, 23, 0xc4ac5665); \
+  OP (FI, A, B, C, D,  0,  6, 0xf4292244); OP (FI, D, A, B, C,  7, 10, 0x432aff97); \
+  OP (FI, C, D, A, B, 14, 15, 0xab9423a7); OP (FI, B, C, D, A,  5, 21, 0xfc93a039); \
+  OP (FI, A, B, C, D, 12,  6, 0x655b59c3); OP (FI, D, A, B, C,  3, 10, 0x8f0ccc92); \
+  OP (FI, C, D, A, B, 10, 15, 0xffeff47d); OP (FI, B, C, D, A,  1, 21, 0x85845dd1); \
+  OP (FI, A, B, C, D,  8,  6, 0x6fa87e4f); OP (FI, D, A, B, C, 15, 10, 0xfe2ce6e0); \
+  OP (FI, C, D, A, B,  6, 15, 0xa3014314); OP (FI, B, C, D, A, 13, 21, 0x4e0811a1); \
+  OP (FI, A, B, C, D,  4,  6, 0xf7537e82); OP (FI, D, A, B, C, 11, 10, 0xbd3af235); \
+  OP (FI, C, D, A, B,  2, 15, 0x2ad7d2bb); OP (FI, B, C, D, A,  9, 21, 0xeb86d391)
+
+/* a message of a batch: its whole blocks in place, the padded end copied */
+typedef struct
+{
+  const byte *data;
+  size_t full;            /* whole blocks read from data */
+  size_t blocks;          /* with the one or two of tail */
+  byte tail[128];
+} md5_lane_t;
+
+static void
+md5_lane_init( md5_lane_t *lane, const void *data, size_t len )
+{
+  size_t rem = len % 64;
+  u32 lsb = (u32)len << 3, msb = (u32)( (uint64_t)len >> 29 );
+
+  lane->data = data;
+  lane->full = len / 64;
+  lane->blocks = lane->full + ( rem < 56 ? 1 : 2 );
+  memset( lane->tail, 0, sizeof(lane->tail) );
+  memcpy( lane->tail, lane->data + 64 * lane->full, rem );
+  lane->tail[rem] = 0x80;
+
+  byte *end = lane->tail + 64 * ( lane->blocks - lane->full ) - 8;
+  for( int i = 0; i < 4; i++ )
+    {
+      end[i] = lsb >> ( 8 * i );
+      end[4 + i] = msb >> ( 8 * i );
+    }
+}
+
+static const byte *
+md5_lane_block( const md5_lane_t *lane, size_t k )
+{
+  static const byte zero[64];
+  if( k >= lane->blocks )
+    return zero;
+  if( k < lane->full )
+    return lane->data + 64 * k;
+  return lane->tail + 64 * ( k - lane->full );
+}
+
+static u32
+md5_word( const byte *p )
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+static void
+md5_lane_digest( byte *digest, u32 a, u32 b, u32 c, u32 d )
+{
+  const u32 v[4] = { a, b, c, d };
+  for( int i = 0; i < 16; i++ )
+    digest[i] = v[i / 4] >> ( 8 * ( i % 4 ) );
+}
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+# include <immintrin.h>
+# define MD5_SIMD 1
+
+/* W lanes of a vector type V, through the intrinsics prefix P */
+#define MD5_SIMD_GROUP( name, isa, V, W, P, SET ) \
+__attribute__((target(isa))) static void \
+name( const md5_lane_t *lanes, unsigned n, byte (*digest)[16] ) \
+{ \
+  V A0 = P##_set1_epi32( 0x67452301 ), B0 = P##_set1_epi32( 0xefcdab89 ); \
+  V C0 = P##_set1_epi32( 0x98badcfe ), D0 = P##_set1_epi32( 0x10325476 ); \
+  V ones = P##_set1_epi32( -1 ); \
+  size_t blocks = 0; \
+  for( unsigned l = 0; l < n; l++ ) \
+    if( lanes[l].blocks > blocks ) \
+      blocks = lanes[l].blocks; \
+  \
+  for( size_t k = 0; k < blocks; k++ ) \
+    { \
+      u32 words[16][W], active[W]; \
+      for( unsigned l = 0; l < W; l++ ) \
+        { \
+          const byte *p = l < n ? md5_lane_block( &lanes[l], k ) : NULL; \
+          for( int i = 0; i < 16; i++ ) \
+            words[i][l] = p ? md5_word( p + 4 * i ) : 0; \
+          active[l] = l < n && k < lanes[l].blocks ? 0xffffffff : 0; \
+        } \
+      V w[16]; \
+      for( int i = 0; i < 16; i++ ) \
+        w[i] = P##_loadu_si##SET( (const V *)words[i] ); \
+      V mask = P##_loadu_si##SET( (const V *)active ); \
+      V A = A0, B = B0, C = C0, D = D0; \
+      MD5_STEPS( VOP ); \
+      A0 = P##_add_epi32( A0, P##_and_si##SET( A, mask ) ); \
+      B0 = P##_add_epi32( B0, P##_and_si##SET( B, mask ) ); \
+      C0 = P##_add_epi32( C0, P##_and_si##SET( C, mask ) ); \
+      D0 = P##_add_epi32( D0, P##_and_si##SET( D, mask ) ); \
+    } \
+  \
+  u32 a[W], b[W], c[W], d[W]; \
+  P##_storeu_si##SET( (V *)a, A0 ); \
+  P##_storeu_si##SET( (V *)b, B0 ); \
+  P##_storeu_si##SET( (V *)c, C0 ); \
+  P##_storeu_si##SET( (V *)d, D0 ); \
+  for( unsigned l = 0; l < n; l++ ) \
+    md5_lane_digest( digest[l], a[l], b[l], c[l], d[l] ); \
+}
+
+#define VOP(f, a, b, c, d, k, s, T) \
+  do \
+    { \
+      a = VADD( a, VADD( V##f( b, c, d ), VADD( w[k], VSET( T ) ) ) ); \
+      a = VOR( VSLL( a, s ), VSRL( a, 32 - s ) ); \
+      a = VADD( a, b ); \
+    } \
+  while (0)
+#define VFF(b, c, d) VXOR( d, VAND( b, VXOR( c, d ) ) )
+#define VFG(b, c, d) VFF( d, b, c )
+#define VFH(b, c, d) VXOR( VXOR( b, c ), d )
+#define VFI(b, c, d) VXOR( c, VOR( b, VXOR( d, ones ) ) )
+
+#define VADD  _mm_add_epi32
+#define VSET  _mm_set1_epi32
+#define VOR   _mm_or_si128
+#define VAND  _mm_and_si128
+#define VXOR  _mm_xor_si128
+#define VSLL  _mm_slli_epi32
+#define VSRL  _mm_srli_epi32
+MD5_SIMD_GROUP( md5_group_sse2, "sse2", __m128i, 4, _mm, 128 )
+#undef VADD
+#undef VSET
+#undef VOR
+#undef VAND
+#undef VXOR
+#undef VSLL
+#undef VSRL
+
+#define VADD  _mm256_add_epi32
+#define VSET  _mm256_set1_epi32
+#define VOR   _mm256_or_si256
+#define VAND  _mm256_and_si256
+#define VXOR  _mm256_xor_si256
+#define VSLL  _mm256_slli_epi32
+#define VSRL  _mm256_srli_epi32
+MD5_SIMD_GROUP( md5_group_avx2, "avx2", __m256i, 8, _mm256, 256 )
+
+/* lanes of the widest unit this CPU has, 1 without any */
+static unsigned
+md5_simd_lanes( void )
+{
+  static int lanes;
+  if( lanes == 0 )
+    {
+      __builtin_cpu_init();
+      lanes = __builtin_cpu_supports( "avx2" ) ? 8 :
+              __builtin_cpu_supports( "sse2" ) ? 4 : 1;
+    }
+  return lanes;
+}
+#endif
+
+void BatchMD5( const void *const *pp_data, const size_t *pi_size,
+               unsigned int i_count, uint8_t (*p_digest)[16] )
+{
+  unsigned int i = 0;
+#ifdef MD5_SIMD
+  unsigned int lanes = i_count > 1 ? md5_simd_lanes() : 1;
+  while( lanes > 1 && i_count - i > 1 )
+    {
+      md5_lane_t group[8];
+      unsigned int n = i_count - i < lanes ? i_count - i : lanes;
+      for( unsigned int l = 0; l < n; l++ )
+        md5_lane_init( &group[l], pp_data[i + l], pi_size[i + l] );
+      /* a short batch does not need the wide unit */
+      if( lanes == 8 && n > 4 )
+        md5_group_avx2( group, n, &p_digest[i] );
+      else
+        md5_group_sse2( group, n, &p_digest[i] );
+      i += n;
+    }
+#endif
+  for( ; i < i_count; i++ )
+    {
+      struct md5_s md5;
+      InitMD5( &md5 );
+      AddMD5( &md5, pp_data[i], pi_size[i] );
+      EndMD5( &md5 );
+      memcpy( p_digest[i], md5.buf, 16 );
+    }
+}
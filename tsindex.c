@@ -0,0 +1,221 @@
+/*****************************************************************************
+ * tsindex.c: caption PES sidecar index
+ *****************************************************************************
+ * File layout (host byte order, the index is a cache and not portable):
+ *   "ARIBIDX1"
+ *   int64 TS size, int64 TS mtime
+ *   int32 PMT PID, int32 PCR PID, int64 first PCR
+ *   int32 caption PID count, uint16 PIDs[count]
+ *   int32 PES count, { int64 pos, int64 pts, uint16 pid } [count]
+ *   int32 PCR count, { int64 pcr, int64 pos } [count]
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include "common.h"
+#include "tsindex.h"
+
+#define TSINDEX_MAGIC       "ARIBIDX1"
+#define TSINDEX_PCR_STEP    (16 * 1024 * 1024) /* bytes between PCR entries */
+
+ts_index_t *IndexNew( void )
+{
+    ts_index_t *p_index = calloc( 1, sizeof(ts_index_t) );
+    if( p_index )
+    {
+        p_index->i_pmt_pid = -1;
+        p_index->i_pcr_pid = -1;
+        p_index->i_first_pcr = -1;
+    }
+    return p_index;
+}
+
+void IndexDelete( ts_index_t *p_index )
+{
+    if( !p_index )
+        return;
+    free( p_index->p_pes );
+    free( p_index->p_pcr );
+    free( p_index );
+}
+
+void IndexAddPES( ts_index_t *p_index, int i_pid, int64_t i_pos, mtime_t i_pts )
+{
+    if( p_index->i_pes >= p_index->i_pes_alloc )
+    {
+        int i_alloc = p_index->i_pes_alloc ? p_index->i_pes_alloc * 2 : 1024;
+        ts_index_pes_t *p_pes = realloc( p_index->p_pes, i_alloc * sizeof(*p_pes) );
+        if( !p_pes )
+            return;
+        p_index->p_pes = p_pes;
+        p_index->i_pes_alloc = i_alloc;
+    }
+    p_index->p_pes[p_index->i_pes].i_pos = i_pos;
+    p_index->p_pes[p_index->i_pes].i_pts = i_pts;
+    p_index->p_pes[p_index->i_pes].i_pid = i_pid;
+    p_index->i_pes++;
+
+    for( int i = 0; i < p_index->i_pids; i++ )
+    {
+        if( p_index->pi_pids[i] == i_pid )
+            return;
+    }
+    if( p_index->i_pids < TSINDEX_MAX_PIDS )
+        p_index->pi_pids[p_index->i_pids++] = i_pid;
+}
+
+void IndexAddPCR( ts_index_t *p_index, mtime_t i_pcr, int64_t i_pos )
+{
+    if( p_index->i_pcr > 0 &&
+        i_pos - p_index->p_pcr[p_index->i_pcr - 1].i_pos < TSINDEX_PCR_STEP )
+        return;
+
+    if( p_index->i_pcr >= p_index->i_pcr_alloc )
+    {
+        int i_alloc = p_index->i_pcr_alloc ? p_index->i_pcr_alloc * 2 : 256;
+        ts_index_pcr_t *p_pcr = realloc( p_index->p_pcr, i_alloc * sizeof(*p_pcr) );
+        if( !p_pcr )
+            return;
+        p_index->p_pcr = p_pcr;
+        p_index->i_pcr_alloc = i_alloc;
+    }
+    p_index->p_pcr[p_index->i_pcr].i_pcr = i_pcr;
+    p_index->p_pcr[p_index->i_pcr].i_pos = i_pos;
+    p_index->i_pcr++;
+}
+
+int IndexWrite( const ts_index_t *p_index, const char *psz_file )
+{
+    char *psz_tmp;
+    FILE *fp;
+    int32_t i32;
+    int i_ret = 0;
+
+    if( asprintf( &psz_tmp, "%s.tmp", psz_file ) < 0 )
+        return -1;
+    fp = vlc_fopen( psz_tmp, "wb" );
+    if( fp == NULL )
+    {
+        free( psz_tmp );
+        return -1;
+    }
+
+#define W( p, n ) do { if( fwrite( (p), (n), 1, fp ) != 1 ) i_ret = -1; } while(0)
+#define W32( v ) do { i32 = (v); W( &i32, 4 ); } while(0)
+    W( TSINDEX_MAGIC, 8 );
+    W( &p_index->i_size, 8 );
+    W( &p_index->i_mtime, 8 );
+    W32( p_index->i_pmt_pid );
+    W32( p_index->i_pcr_pid );
+    W( &p_index->i_first_pcr, 8 );
+    W32( p_index->i_pids );
+    for( int i = 0; i < p_index->i_pids; i++ )
+        W( &p_index->pi_pids[i], 2 );
+    W32( p_index->i_pes );
+    for( int i = 0; i < p_index->i_pes; i++ )
+    {
+        W( &p_index->p_pes[i].i_pos, 8 );
+        W( &p_index->p_pes[i].i_pts, 8 );
+        W( &p_index->p_pes[i].i_pid, 2 );
+    }
+    W32( p_index->i_pcr );
+    for( int i = 0; i < p_index->i_pcr; i++ )
+    {
+        W( &p_index->p_pcr[i].i_pcr, 8 );
+        W( &p_index->p_pcr[i].i_pos, 8 );
+    }
+#undef W32
+#undef W
+
+    if( fclose( fp ) != 0 )
+        i_ret = -1;
+    if( i_ret == 0 && rename( psz_tmp, psz_file ) != 0 )
+        i_ret = -1;
+    if( i_ret != 0 )
+        unlink( psz_tmp );
+    free( psz_tmp );
+    return i_ret;
+}
+
+/* returns NULL when there is no index or it was built from another file */
+ts_index_t *IndexRead( const char *psz_file, int64_t i_size, int64_t i_mtime )
+{
+    ts_index_t *p_index;
+    char psz_magic[8];
+    int32_t i32;
+    FILE *fp = vlc_fopen( psz_file, "rb" );
+    if( fp == NULL )
+        return NULL;
+
+    p_index = IndexNew();
+    if( p_index == NULL )
+        goto error;
+
+#define R( p, n ) do { if( fread( (p), (n), 1, fp ) != 1 ) goto error; } while(0)
+#define R32( v ) do { R( &i32, 4 ); (v) = i32; } while(0)
+    R( psz_magic, 8 );
+    if( memcmp( psz_magic, TSINDEX_MAGIC, 8 ) )
+        goto error;
+    R( &p_index->i_size, 8 );
+    R( &p_index->i_mtime, 8 );
+    if( p_index->i_size != i_size || p_index->i_mtime != i_mtime )
+        goto error;
+    R32( p_index->i_pmt_pid );
+    R32( p_index->i_pcr_pid );
+    R( &p_index->i_first_pcr, 8 );
+    R32( p_index->i_pids );
+    if( p_index->i_pids < 0 || p_index->i_pids > TSINDEX_MAX_PIDS ||
+        p_index->i_pmt_pid < 0 || p_index->i_pmt_pid > 0x1fff ||
+        p_index->i_pcr_pid < 0 || p_index->i_pcr_pid > 0x1fff )
+        goto error;
+    for( int i = 0; i < p_index->i_pids; i++ )
+    {
+        R( &p_index->pi_pids[i], 2 );
+        if( p_index->pi_pids[i] > 0x1fff )
+            goto error;
+    }
+
+    R32( p_index->i_pes );
+    if( p_index->i_pes < 0 )
+        goto error;
+    p_index->i_pes_alloc = p_index->i_pes;
+    p_index->p_pes = malloc( ( p_index->i_pes + 1 ) * sizeof(ts_index_pes_t) );
+    if( p_index->p_pes == NULL )
+        goto error;
+    for( int i = 0; i < p_index->i_pes; i++ )
+    {
+        R( &p_index->p_pes[i].i_pos, 8 );
+        R( &p_index->p_pes[i].i_pts, 8 );
+        R( &p_index->p_pes[i].i_pid, 2 );
+        if( p_index->p_pes[i].i_pid > 0x1fff ||
+            p_index->p_pes[i].i_pos < 0 || p_index->p_pes[i].i_pos >= i_size )
+            goto error;
+    }
+
+    R32( p_index->i_pcr );
+    if( p_index->i_pcr < 0 )
+        goto error;
+    p_index->i_pcr_alloc = p_index->i_pcr;
+    p_index->p_pcr = malloc( ( p_index->i_pcr + 1 ) * sizeof(ts_index_pcr_t) );
+    if( p_index->p_pcr == NULL )
+        goto error;
+    for( int i = 0; i < p_index->i_pcr; i++ )
+    {
+        R( &p_index->p_pcr[i].i_pcr, 8 );
+        R( &p_index->p_pcr[i].i_pos, 8 );
+    }
+#undef R32
+#undef R
+
+    fclose( fp );
+    return p_index;
+
+error:
+    IndexDelete( p_index );
+    fclose( fp );
+    return NULL;
+}
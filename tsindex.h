@@ -0,0 +1,55 @@
+/*****************************************************************************
+ * tsindex.h: caption PES sidecar index
+ *****************************************************************************
+ * The index is written next to the TS as <filename>.assidx and lets a later
+ * run read only the packets carrying caption PES instead of the whole file.
+ *****************************************************************************/
+
+#ifndef TSINDEX_H
+# define TSINDEX_H
+
+#define TSINDEX_MAX_PIDS    8
+
+typedef struct ts_index_pes_s
+{
+    int64_t     i_pos;      /* offset of the PES unit start packet */
+    mtime_t     i_pts;
+    uint16_t    i_pid;
+} ts_index_pes_t;
+
+typedef struct ts_index_pcr_s
+{
+    mtime_t     i_pcr;
+    int64_t     i_pos;
+} ts_index_pcr_t;
+
+typedef struct ts_index_s
+{
+    /* identify the TS the index was built from */
+    int64_t     i_size;
+    int64_t     i_mtime;
+
+    /* PSI summary */
+    int         i_pmt_pid;
+    int         i_pcr_pid;
+    mtime_t     i_first_pcr;
+    int         i_pids;
+    uint16_t    pi_pids[TSINDEX_MAX_PIDS];
+
+    int             i_pes;
+    int             i_pes_alloc;
+    ts_index_pes_t  *p_pes;
+
+    int             i_pcr;
+    int             i_pcr_alloc;
+    ts_index_pcr_t  *p_pcr;
+} ts_index_t;
+
+ts_index_t *IndexNew( void );
+void IndexDelete( ts_index_t * );
+void IndexAddPES( ts_index_t *, int, int64_t, mtime_t );
+void IndexAddPCR( ts_index_t *, mtime_t, int64_t );
+int  IndexWrite( const ts_index_t *, const char * );
+ts_index_t *IndexRead( const char *, int64_t, int64_t );
+
+#endif
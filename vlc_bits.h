@@ -194,4 +194,198 @@ static inline void bs_align_1( bs_t *s )
     }
 }
 
+/*
+ * bs64_t: read only bit stream keeping up to 64 bits in a left aligned
+ * cache refilled with 8 byte big endian loads. Reading past the end
+ * returns zero bits, like bs_read.
+ */
+typedef struct bs64_s
+{
+    const uint8_t *p_start;
+    const uint8_t *p;       /* next byte to load into the cache */
+    const uint8_t *p_end;
+
+    uint64_t i_cache;       /* valid bits first, zero below them */
+    int      i_bits;        /* number of valid bits in i_cache */
+} bs64_t;
+
+static inline uint64_t bs64_load( const uint8_t *p )
+{
+    return ( (uint64_t)p[0] << 56 ) | ( (uint64_t)p[1] << 48 ) |
+           ( (uint64_t)p[2] << 40 ) | ( (uint64_t)p[3] << 32 ) |
+           ( (uint64_t)p[4] << 24 ) | ( (uint64_t)p[5] << 16 ) |
+           ( (uint64_t)p[6] <<  8 ) |   (uint64_t)p[7];
+}
+
+static inline void bs64_init( bs64_t *s, const void *p_data, size_t i_data )
+{
+    s->p_start = p_data;
+    s->p       = s->p_start;
+    s->p_end   = s->p_start + i_data;
+    s->i_cache = 0;
+    s->i_bits  = 0;
+}
+
+static inline void bs64_refill( bs64_t *s )
+{
+    if( s->p_end - s->p >= 8 )
+    {
+        const int i_bytes = ( 64 - s->i_bits ) >> 3;
+
+        s->i_cache |= bs64_load( s->p ) >> s->i_bits;
+        s->p      += i_bytes;
+        s->i_bits += 8 * i_bytes;
+        if( s->i_bits < 64 )
+            s->i_cache &= ~( UINT64_MAX >> s->i_bits );
+    }
+    else
+    {
+        while( s->i_bits <= 56 && s->p < s->p_end )
+        {
+            s->i_cache |= (uint64_t)*s->p++ << ( 56 - s->i_bits );
+            s->i_bits += 8;
+        }
+    }
+}
+
+static inline size_t bs64_pos( const bs64_t *s )
+{
+    return 8 * ( s->p - s->p_start ) - s->i_bits;
+}
+
+/* number of bits left to read */
+static inline size_t bs64_remain( const bs64_t *s )
+{
+    return 8 * ( s->p_end - s->p ) + s->i_bits;
+}
+
+static inline int bs64_eof( const bs64_t *s )
+{
+    return s->p >= s->p_end && s->i_bits == 0;
+}
+
+/* i_count must be within 0..32 */
+static inline uint32_t bs64_read( bs64_t *s, int i_count )
+{
+    uint32_t i_result;
+
+    if( i_count <= 0 )
+        return 0;
+    if( s->i_bits < i_count )
+        bs64_refill( s );
+
+    i_result = s->i_cache >> ( 64 - i_count );
+    if( s->i_bits >= i_count )
+    {
+        s->i_cache <<= i_count;
+        s->i_bits   -= i_count;
+    }
+    else
+    {
+        /* ran out of data, the missing low bits read as zero */
+        s->i_cache = 0;
+        s->i_bits  = 0;
+    }
+    return i_result;
+}
+
+static inline void bs64_skip( bs64_t *s, size_t i_count )
+{
+    if( i_count <= (size_t)s->i_bits )
+    {
+        s->i_cache = i_count < 64 ? s->i_cache << i_count : 0;
+        s->i_bits -= i_count;
+        return;
+    }
+    i_count -= s->i_bits;
+    s->i_cache = 0;
+    s->i_bits  = 0;
+    if( i_count / 8 >= (size_t)( s->p_end - s->p ) )
+    {
+        s->p = s->p_end;
+        return;
+    }
+    s->p += i_count / 8;
+    bs64_read( s, i_count % 8 );
+}
+
+/*
+ * Copies i_count bytes, the part past the end of the stream reads as zero.
+ * Returns the number of bytes really taken from the stream.
+ */
+static inline size_t bs64_read_bytes( bs64_t *s, void *p_dst, size_t i_count )
+{
+    const size_t i_remain = bs64_remain( s );
+    uint8_t *p = p_dst;
+    size_t i = 0;
+
+    if( s->i_bits & 7 )
+    {
+        /* not byte aligned, every byte straddles two source bytes */
+        for( ; i < i_count; i++ )
+            p[i] = bs64_read( s, 8 );
+    }
+    else
+    {
+        /* drain the cache, then one copy from the buffer */
+        for( ; i < i_count && s->i_bits > 0; i++ )
+            p[i] = bs64_read( s, 8 );
+        if( i < i_count )
+        {
+            size_t i_copy = __MIN( i_count - i, (size_t)( s->p_end - s->p ) );
+            memcpy( &p[i], s->p, i_copy );
+            memset( &p[i + i_copy], 0, i_count - i - i_copy );
+            s->p += i_copy;
+        }
+    }
+    return ( i_remain - bs64_remain( s ) ) / 8;
+}
+
+static inline void bs64_skip_bytes( bs64_t *s, size_t i_count )
+{
+    bs64_skip( s, 8 * i_count );
+}
+
+/* byte aligned reads straight from the buffer when the cache is empty */
+static inline uint32_t bs64_read_u8( bs64_t *s )
+{
+    if( s->i_bits == 0 && s->p < s->p_end )
+        return *s->p++;
+    return bs64_read( s, 8 );
+}
+
+static inline uint32_t bs64_read_u16( bs64_t *s )
+{
+    if( s->i_bits == 0 && s->p_end - s->p >= 2 )
+    {
+        uint32_t i_result = ( s->p[0] << 8 ) | s->p[1];
+        s->p += 2;
+        return i_result;
+    }
+    return bs64_read( s, 16 );
+}
+
+static inline uint32_t bs64_read_u24( bs64_t *s )
+{
+    if( s->i_bits == 0 && s->p_end - s->p >= 3 )
+    {
+        uint32_t i_result = ( s->p[0] << 16 ) | ( s->p[1] << 8 ) | s->p[2];
+        s->p += 3;
+        return i_result;
+    }
+    return bs64_read( s, 24 );
+}
+
+static inline uint32_t bs64_read_u32( bs64_t *s )
+{
+    if( s->i_bits == 0 && s->p_end - s->p >= 4 )
+    {
+        uint32_t i_result = ( (uint32_t)s->p[0] << 24 ) | ( s->p[1] << 16 ) |
+                            ( s->p[2] << 8 ) | s->p[3];
+        s->p += 4;
+        return i_result;
+    }
+    return bs64_read( s, 32 );
+}
+
 #endif
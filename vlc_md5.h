@@ -40,6 +40,8 @@ struct md5_s
 void InitMD5( struct md5_s * );
 void AddMD5( struct md5_s *, const void *, size_t );
 void EndMD5( struct md5_s * );
+/* the digests of i_count buffers at once, as EndMD5 leaves them in buf */
+void BatchMD5( const void *const *, const size_t *, unsigned int, uint8_t (*)[16] );
 
 /**
  * Returns a char representation of the md5 hash, as shown by UNIX md5 or